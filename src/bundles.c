@@ -0,0 +1,548 @@
+/*
+  Copyright 2007-2016 David Robillard <http://drobilla.net>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THIS SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+/**
+   @file bundles.c Persistent index of the bundles each plugin needs.
+
+   Loading every installed bundle parses the data of every plugin on the
+   system, which dominates startup when many are installed.  This index maps
+   plugin URIs to the bundles that describe the plugin, its UIs, and its
+   presets, so that only those need to be loaded.
+
+   The index is a text file with one record per line:
+
+   E LV2_PATH           The value of LV2_PATH when the index was written
+   D MTIME PATH         A directory and its modification time
+   P URI                A plugin, followed by the bundles it needs:
+   B PATH               A bundle directory path, with a trailing slash
+
+   Directories are the LV2_PATH entries, every indexed bundle, and the
+   directory containing it.  Installing or removing a bundle changes one of
+   these, so if any modification time differs, the whole index is stale.
+
+   Property definitions are not recorded, since lilv does not say which
+   bundle a statement came from, and they may be in any bundle, such as an
+   LV2 specification.  If a property of the plugin is not described by the
+   indexed bundles, everything is loaded as if there were no index.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#ifdef _WIN32
+#    include <direct.h>
+#    include <process.h>
+#    define mkdir(path, mode) _mkdir(path)
+#    define getpid _getpid
+#else
+#    include <unistd.h>
+#endif
+
+#include "lv2/patch/patch.h"
+
+#include "jalv_internal.h"
+
+#ifdef _WIN32
+#    define LV2_PATH_SEP ';'
+#    define DEFAULT_LV2_PATH "%APPDATA%\\LV2;%COMMONPROGRAMFILES%\\LV2"
+#elif defined(__APPLE__)
+#    define LV2_PATH_SEP ':'
+#    define DEFAULT_LV2_PATH \
+	"~/Library/Audio/Plug-Ins/LV2:~/.lv2:/usr/local/lib/lv2:/usr/lib/lv2:" \
+	"/Library/Audio/Plug-Ins/LV2"
+#else
+#    define LV2_PATH_SEP ':'
+#    define DEFAULT_LV2_PATH "~/.lv2:/usr/local/lib/lv2:/usr/lib/lv2"
+#endif
+
+/** Maximum length of a line in the index, longer lines make it stale. */
+#define INDEX_MAX_LINE 4096
+
+typedef struct {
+	char*     path;   ///< Directory path
+	long long mtime;  ///< Modification time when indexed
+} IndexDir;
+
+typedef struct {
+	char*    uri;        ///< Plugin URI
+	char**   bundles;    ///< Paths of bundles the plugin needs
+	unsigned n_bundles;  ///< Number of bundles
+} IndexEntry;
+
+typedef struct {
+	char*       lv2_path;   ///< LV2_PATH when indexed, or ""
+	IndexDir*   dirs;       ///< Directories that invalidate the index
+	unsigned    n_dirs;     ///< Number of directories
+	IndexEntry* entries;    ///< Indexed plugins
+	unsigned    n_entries;  ///< Number of indexed plugins
+} BundleIndex;
+
+/** Return the modification time of a directory, or 0 if it does not exist. */
+static long long
+dir_mtime(const char* path)
+{
+	struct stat info;
+	return stat(path, &info) ? 0 : (long long)info.st_mtime;
+}
+
+/** Return the value of LV2_PATH, or "" if it is unset. */
+static const char*
+get_lv2_path(void)
+{
+	const char* lv2_path = getenv("LV2_PATH");
+	return lv2_path ? lv2_path : "";
+}
+
+char*
+jalv_cache_path(const char* name)
+{
+#ifdef _WIN32
+	const char* cache = getenv("LOCALAPPDATA");
+	char*       dir   = cache ? jalv_strjoin(cache, "\\jalv\\") : NULL;
+#else
+	const char* cache = getenv("XDG_CACHE_HOME");
+	const char* home  = getenv("HOME");
+	char*       dir   = NULL;
+	if (cache && cache[0]) {
+		dir = jalv_strjoin(cache, "/jalv/");
+	} else if (home) {
+		dir = jalv_strjoin(home, "/.cache/jalv/");
+	}
+#endif
+
+	char* const path = dir ? jalv_strjoin(dir, name) : NULL;
+	free(dir);
+	return path;
+}
+
+static void
+add_string(char*** strings, unsigned* n_strings, const char* str)
+{
+	for (unsigned i = 0; i < *n_strings; ++i) {
+		if (!strcmp((*strings)[i], str)) {
+			return;
+		}
+	}
+
+	*strings = (char**)realloc(*strings, (*n_strings + 1) * sizeof(char*));
+	(*strings)[(*n_strings)++] = jalv_strdup(str);
+}
+
+static void
+add_dir(BundleIndex* index, const char* path, long long mtime)
+{
+	for (unsigned i = 0; i < index->n_dirs; ++i) {
+		if (!strcmp(index->dirs[i].path, path)) {
+			return;
+		}
+	}
+
+	index->dirs = (IndexDir*)realloc(
+		index->dirs, (index->n_dirs + 1) * sizeof(IndexDir));
+	index->dirs[index->n_dirs].path  = jalv_strdup(path);
+	index->dirs[index->n_dirs].mtime = mtime;
+	++index->n_dirs;
+}
+
+static IndexEntry*
+add_entry(BundleIndex* index, const char* uri)
+{
+	index->entries = (IndexEntry*)realloc(
+		index->entries, (index->n_entries + 1) * sizeof(IndexEntry));
+
+	IndexEntry* const entry = &index->entries[index->n_entries++];
+	entry->uri       = jalv_strdup(uri);
+	entry->bundles   = NULL;
+	entry->n_bundles = 0;
+	return entry;
+}
+
+static const IndexEntry*
+find_entry(const BundleIndex* index, const char* uri)
+{
+	for (unsigned i = 0; i < index->n_entries; ++i) {
+		if (!strcmp(index->entries[i].uri, uri)) {
+			return &index->entries[i];
+		}
+	}
+	return NULL;
+}
+
+static void
+index_free(BundleIndex* index)
+{
+	for (unsigned i = 0; i < index->n_dirs; ++i) {
+		free(index->dirs[i].path);
+	}
+	for (unsigned i = 0; i < index->n_entries; ++i) {
+		for (unsigned b = 0; b < index->entries[i].n_bundles; ++b) {
+			free(index->entries[i].bundles[b]);
+		}
+		free(index->entries[i].bundles);
+		free(index->entries[i].uri);
+	}
+	free(index->lv2_path);
+	free(index->dirs);
+	free(index->entries);
+	memset(index, '\0', sizeof(BundleIndex));
+}
+
+/**
+   Read the index from `path`.
+
+   Returns zero if the index was read and is still valid.  Whatever could be
+   read is in `index` regardless, so stale entries can be re-indexed.
+*/
+static int
+index_read(BundleIndex* index, const char* path)
+{
+	FILE* fd = path ? fopen(path, "r") : NULL;
+	if (!fd) {
+		return 1;
+	}
+
+	char        line[INDEX_MAX_LINE];
+	IndexEntry* entry = NULL;
+	int         stale = 0;
+	while (fgets(line, sizeof(line), fd)) {
+		const size_t len = strlen(line);
+		if (len < 3 || line[len - 1] != '\n' || line[1] != ' ') {
+			stale = 1;  // Truncated or corrupt
+			break;
+		}
+
+		line[len - 1] = '\0';
+		char* const value = line + 2;
+		switch (line[0]) {
+		case 'E':
+			free(index->lv2_path);
+			index->lv2_path = jalv_strdup(value);
+			stale |= !!strcmp(value, get_lv2_path());
+			break;
+		case 'D': {
+			char*           dir   = NULL;
+			const long long mtime = strtoll(value, &dir, 10);
+			if (*dir++ != ' ') {
+				stale = 1;
+			} else {
+				add_dir(index, dir, mtime);
+				stale |= (dir_mtime(dir) != mtime);
+			}
+			break;
+		}
+		case 'P':
+			entry = add_entry(index, value);
+			break;
+		case 'B':
+			if (entry) {
+				add_string(&entry->bundles, &entry->n_bundles, value);
+			}
+			break;
+		default:
+			stale = 1;
+		}
+	}
+
+	fclose(fd);
+	return stale || !index->lv2_path;
+}
+
+void
+jalv_create_parents(const char* path)
+{
+	char* const dir = jalv_strdup(path);
+	for (char* s = dir + 1; *s; ++s) {
+		if (*s == '/' || *s == '\\') {
+			const char sep = *s;
+			*s = '\0';
+			mkdir(dir, 0755);  // Fails harmlessly if it exists
+			*s = sep;
+		}
+	}
+	free(dir);
+}
+
+char*
+jalv_temp_path(const char* path)
+{
+	char suffix[32];
+	snprintf(suffix, sizeof(suffix), ".%ld.new", (long)getpid());
+	return jalv_strjoin(path, suffix);
+}
+
+/** Write the index to `path`, replacing any existing one atomically. */
+static int
+index_write(const BundleIndex* index, const char* path)
+{
+	jalv_create_parents(path);
+
+	char* const tmp_path = jalv_temp_path(path);
+	FILE*       fd       = fopen(tmp_path, "w");
+	if (!fd) {
+		free(tmp_path);
+		return 1;
+	}
+
+	fprintf(fd, "E %s\n", index->lv2_path);
+	for (unsigned i = 0; i < index->n_dirs; ++i) {
+		fprintf(fd, "D %lld %s\n", index->dirs[i].mtime, index->dirs[i].path);
+	}
+	for (unsigned i = 0; i < index->n_entries; ++i) {
+		fprintf(fd, "P %s\n", index->entries[i].uri);
+		for (unsigned b = 0; b < index->entries[i].n_bundles; ++b) {
+			fprintf(fd, "B %s\n", index->entries[i].bundles[b]);
+		}
+	}
+
+	int st = ferror(fd);
+	st |= fclose(fd);
+#ifdef _WIN32
+	remove(path);
+#endif
+	if (st || rename(tmp_path, path)) {
+		remove(tmp_path);
+		st = 1;
+	}
+
+	free(tmp_path);
+	return st;
+}
+
+/** Expand a leading "~" or, on Windows, a leading "%VAR%" in a path. */
+static char*
+expand_path(const char* path)
+{
+	if (path[0] == '~' && getenv("HOME")) {
+		return jalv_strjoin(getenv("HOME"), path + 1);
+	}
+#ifdef _WIN32
+	const char* end = path[0] == '%' ? strchr(path + 1, '%') : NULL;
+	if (end) {
+		char* const var = jalv_strdup(path + 1);
+		var[end - path - 1] = '\0';
+		const char* value = getenv(var);
+		free(var);
+		if (value) {
+			return jalv_strjoin(value, end + 1);
+		}
+	}
+#endif
+	return jalv_strdup(path);
+}
+
+/** Add the directories of the LV2 path, where bundles are installed. */
+static void
+add_lv2_path_dirs(BundleIndex* index)
+{
+	const char* lv2_path = getenv("LV2_PATH");
+	char* const paths    = jalv_strdup(lv2_path ? lv2_path : DEFAULT_LV2_PATH);
+	for (char* p = paths; p;) {
+		char* const sep = strchr(p, LV2_PATH_SEP);
+		if (sep) {
+			*sep = '\0';
+		}
+
+		if (*p) {
+			char* const dir = expand_path(p);
+			add_dir(index, dir, dir_mtime(dir));
+			free(dir);
+		}
+
+		p = sep ? sep + 1 : NULL;
+	}
+	free(paths);
+}
+
+/** Add the bundle containing the file (or bundle directory) at `uri`. */
+static void
+add_bundle(BundleIndex* index, IndexEntry* entry, const LilvNode* uri)
+{
+	char* const path = lilv_file_uri_parse(lilv_node_as_uri(uri), NULL);
+	char*       sep  = path ? strrchr(path, '/') : NULL;
+	if (sep) {
+		// Add the bundle, with a trailing slash like lilv bundle URIs
+		sep[1] = '\0';
+		add_string(&entry->bundles, &entry->n_bundles, path);
+		add_dir(index, path, dir_mtime(path));
+
+		// Add the directory that contains it, where bundles are installed
+		sep[0] = '\0';
+		if ((sep = strrchr(path, '/'))) {
+			sep[sep == path ? 1 : 0] = '\0';
+			add_dir(index, path, dir_mtime(path));
+		}
+	}
+	lilv_free(path);
+}
+
+/** Index the bundles that describe a plugin, its UIs, and its presets. */
+static void
+index_plugin(Jalv*             jalv,
+             BundleIndex*      index,
+             const LilvPlugin* plugin,
+             const LilvNode*   rdfs_seeAlso)
+{
+	IndexEntry* const entry = add_entry(
+		index, lilv_node_as_uri(lilv_plugin_get_uri(plugin)));
+
+	add_bundle(index, entry, lilv_plugin_get_bundle_uri(plugin));
+
+	const LilvNodes* data_uris = lilv_plugin_get_data_uris(plugin);
+	LILV_FOREACH(nodes, d, data_uris) {
+		add_bundle(index, entry, lilv_nodes_get(data_uris, d));
+	}
+
+	LilvUIs* uis = lilv_plugin_get_uis(plugin);
+	LILV_FOREACH(uis, u, uis) {
+		add_bundle(index, entry, lilv_ui_get_bundle_uri(lilv_uis_get(uis, u)));
+	}
+	lilv_uis_free(uis);
+
+	LilvNodes* presets = lilv_plugin_get_related(plugin,
+	                                             jalv->nodes.pset_Preset);
+	LILV_FOREACH(nodes, p, presets) {
+		LilvNodes* files = lilv_world_find_nodes(
+			jalv->world, lilv_nodes_get(presets, p), rdfs_seeAlso, NULL);
+		LILV_FOREACH(nodes, f, files) {
+			add_bundle(index, entry, lilv_nodes_get(files, f));
+		}
+		lilv_nodes_free(files);
+	}
+	lilv_nodes_free(presets);
+}
+
+/** Load the bundles of an indexed plugin. */
+static void
+load_entry(LilvWorld* world, const IndexEntry* entry)
+{
+	for (unsigned b = 0; b < entry->n_bundles; ++b) {
+		LilvNode* bundle = lilv_new_file_uri(world, NULL, entry->bundles[b]);
+		lilv_world_load_bundle(world, bundle);
+		lilv_node_free(bundle);
+	}
+}
+
+/** Return true iff every patch property of a plugin has a known range. */
+static bool
+has_property_ranges(Jalv* jalv, const char* plugin_uri)
+{
+	LilvWorld* const world   = jalv->world;
+	LilvNode* const  uri     = lilv_new_uri(world, plugin_uri);
+	const char*      preds[] = { LV2_PATCH__writable, LV2_PATCH__readable };
+	bool             result  = true;
+	for (unsigned i = 0; result && i < 2; ++i) {
+		LilvNode*  pred       = lilv_new_uri(world, preds[i]);
+		LilvNodes* properties = lilv_world_find_nodes(world, uri, pred, NULL);
+		LILV_FOREACH(nodes, p, properties) {
+			LilvNode* range = lilv_world_get(
+				world, lilv_nodes_get(properties, p), jalv->nodes.rdfs_range,
+				NULL);
+			result = result && range;
+			lilv_node_free(range);
+		}
+		lilv_nodes_free(properties);
+		lilv_node_free(pred);
+	}
+	lilv_node_free(uri);
+	return result;
+}
+
+int
+jalv_check_indexed_bundles(Jalv* jalv, const char* plugin_uri)
+{
+	int st = !has_property_ranges(jalv, plugin_uri);
+	for (char** i = jalv->opts.instances; !st && i && *i; ++i) {
+		st = !has_property_ranges(jalv, *i);
+	}
+	return st;
+}
+
+int
+jalv_load_indexed_bundles(Jalv* jalv, const char* plugin_uri)
+{
+	char* const path  = jalv_cache_path("bundles");
+	BundleIndex index = { NULL, NULL, 0, NULL, 0 };
+	int         st    = index_read(&index, path);
+
+	// Only use the index if it has every plugin this process will open
+	const IndexEntry* entry = st ? NULL : find_entry(&index, plugin_uri);
+	st = st || !entry;
+	for (char** i = jalv->opts.instances; !st && i && *i; ++i) {
+		st = !find_entry(&index, *i);
+	}
+
+	if (!st) {
+		load_entry(jalv->world, entry);
+		for (char** i = jalv->opts.instances; i && *i; ++i) {
+			load_entry(jalv->world, find_entry(&index, *i));
+		}
+	}
+
+	index_free(&index);
+	free(path);
+	return st;
+}
+
+void
+jalv_index_bundles(Jalv* jalv, const char* plugin_uri)
+{
+	char* const path = jalv_cache_path("bundles");
+	if (!path) {
+		return;
+	}
+
+	// Re-index everything in the old index, in case it was stale
+	BundleIndex old = { NULL, NULL, 0, NULL, 0 };
+	index_read(&old, path);
+
+	char**   uris   = NULL;
+	unsigned n_uris = 0;
+	add_string(&uris, &n_uris, plugin_uri);
+	for (char** i = jalv->opts.instances; i && *i; ++i) {
+		add_string(&uris, &n_uris, *i);
+	}
+	for (unsigned i = 0; i < old.n_entries; ++i) {
+		add_string(&uris, &n_uris, old.entries[i].uri);
+	}
+	index_free(&old);
+
+	BundleIndex index = { jalv_strdup(get_lv2_path()), NULL, 0, NULL, 0 };
+	add_lv2_path_dirs(&index);
+
+	const LilvPlugins* plugins = lilv_world_get_all_plugins(jalv->world);
+	LilvNode* rdfs_seeAlso = lilv_new_uri(jalv->world, LILV_NS_RDFS "seeAlso");
+	for (unsigned i = 0; i < n_uris; ++i) {
+		LilvNode*         uri    = lilv_new_uri(jalv->world, uris[i]);
+		const LilvPlugin* plugin = lilv_plugins_get_by_uri(plugins, uri);
+		if (plugin) {
+			index_plugin(jalv, &index, plugin, rdfs_seeAlso);
+		}
+		lilv_node_free(uri);
+		free(uris[i]);
+	}
+	lilv_node_free(rdfs_seeAlso);
+	free(uris);
+
+	if (index_write(&index, path)) {
+		fprintf(stderr, "warning: Failed to write bundle index %s\n", path);
+	}
+
+	index_free(&index);
+	free(path);
+}
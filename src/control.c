@@ -27,6 +27,21 @@ scale_point_cmp(const ScalePoint* a, const ScalePoint* b)
 	return 1;
 }
 
+void
+scale_sample_rate_range(Jalv* jalv, ControlID* control)
+{
+	if (lilv_node_is_float(control->min) || lilv_node_is_int(control->min)) {
+		const float min = lilv_node_as_float(control->min) * jalv->sample_rate;
+		lilv_node_free(control->min);
+		control->min = lilv_new_float(jalv->world, min);
+	}
+	if (lilv_node_is_float(control->max) || lilv_node_is_int(control->max)) {
+		const float max = lilv_node_as_float(control->max) * jalv->sample_rate;
+		lilv_node_free(control->max);
+		control->max = lilv_new_float(jalv->world, max);
+	}
+}
+
 ControlID*
 new_port_control(Jalv* jalv, uint32_t index)
 {
@@ -53,17 +68,7 @@ new_port_control(Jalv* jalv, uint32_t index)
 
 	lilv_port_get_range(plug, lport, &id->def, &id->min, &id->max);
 	if (lilv_port_has_property(plug, lport, jalv->nodes.lv2_sampleRate)) {
-		/* Adjust range for lv2:sampleRate controls */
-		if (lilv_node_is_float(id->min) || lilv_node_is_int(id->min)) {
-			const float min = lilv_node_as_float(id->min) * jalv->sample_rate;
-			lilv_node_free(id->min);
-			id->min = lilv_new_float(jalv->world, min);
-		}
-		if (lilv_node_is_float(id->max) || lilv_node_is_int(id->max)) {
-			const float max = lilv_node_as_float(id->max) * jalv->sample_rate;
-			lilv_node_free(id->max);
-			id->max = lilv_new_float(jalv->world, max);
-		}
+		scale_sample_rate_range(jalv, id);
 	}
 
 	/* Get scale points */
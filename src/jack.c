@@ -15,6 +15,10 @@
 */
 
 #include <ctype.h>
+#include <time.h>
+#ifndef _WIN32
+#    include <unistd.h>
+#endif
 
 #include <jack/jack.h>
 #include <jack/midiport.h>
@@ -27,10 +31,42 @@
 
 #include "jalv_internal.h"
 #include "worker.h"
+#include "zix/atomic.h"
+
+/**
+   Pool of realtime threads for processing several instances in parallel.
+
+   In each cycle, the process thread and every pool thread repeatedly claim
+   the next unprocessed instance from a shared atomic index, so busy threads
+   naturally leave work to idle ones.  The process thread then waits for all
+   instances to finish before returning to Jack.
+
+   The process callback counts itself in `users` while it uses the pool.  To
+   stop the pool, the closing thread sets JACK_DSP_POOL_CLOSED in `users` and
+   waits for the callback to leave, which also works for internal clients
+   whose callback keeps running after deactivation.
+*/
+typedef struct {
+	jack_native_thread_t* threads;   ///< Pool threads
+	uint32_t              n_threads; ///< Number of pool threads
+	uint32_t              users;     ///< Callbacks in pool, and closed flag
+	ZixSem                start;     ///< Posted for each thread every cycle
+	ZixSem                done;      ///< Posted when all instances finished
+	uint32_t              next;      ///< Index of next instance to process
+	uint32_t              remaining; ///< Number of unfinished instances
+	uint32_t              latency;   ///< Non-zero if a latency changed
+	uint32_t              exit;      ///< Non-zero if threads must exit
+	jack_nframes_t        nframes;   ///< Length of current cycle
+	const LV2_Atom*       xport;     ///< Transport change for current cycle
+} JalvDspPool;
+
+/** Flag set in JalvDspPool::users once the pool may no longer be used. */
+#define JACK_DSP_POOL_CLOSED 0x80000000u
 
 struct JalvBackend {
 	jack_client_t* client;             ///< Jack client
 	bool           is_internal_client; ///< Running inside jackd
+	JalvDspPool    pool;               ///< Threads for additional instances
 };
 
 /** Internal Jack client initialization entry point */
@@ -44,13 +80,16 @@ static int
 jack_buffer_size_cb(jack_nframes_t nframes, void* data)
 {
 	Jalv* const jalv = (Jalv*)data;
-	jalv->block_length = nframes;
-	jalv->buf_size_set = true;
+	for (uint32_t i = 0; i <= jalv->n_instances; ++i) {
+		Jalv* const inst = i ? jalv->instances[i - 1] : jalv;
+		inst->block_length = nframes;
+		inst->buf_size_set = true;
 #ifdef HAVE_JACK_PORT_TYPE_GET_BUFFER_SIZE
-	jalv->midi_buf_size = jack_port_type_get_buffer_size(
-		jalv->backend->client, JACK_DEFAULT_MIDI_TYPE);
+		inst->midi_buf_size = jack_port_type_get_buffer_size(
+			jalv->backend->client, JACK_DEFAULT_MIDI_TYPE);
 #endif
-	jalv_allocate_port_buffers(jalv);
+		jalv_allocate_port_buffers(inst);
+	}
 	return 0;
 }
 
@@ -63,6 +102,193 @@ jack_shutdown_cb(void* data)
 	zix_sem_post(&jalv->done);
 }
 
+/**
+   Process a single plugin instance for one cycle.
+
+   If `xport` is not NULL, it is a transport change event to deliver to the
+   plugin before any other input.  Returns true iff the plugin latency changed.
+
+   This may be called from any thread of the DSP pool, so must not touch
+   anything shared between instances.
+*/
+static REALTIME bool
+jack_process_instance(Jalv* const           jalv,
+                      const jack_nframes_t  nframes,
+                      const LV2_Atom* const xport)
+{
+	const JalvProcessPlan* const plan = &jalv->plan;
+
+	switch (jalv->play_state) {
+	case JALV_PAUSE_REQUESTED:
+		jalv->play_state = JALV_PAUSED;
+		zix_sem_post(&jalv->paused);
+		break;
+	case JALV_PAUSED:
+		for (uint32_t i = 0; i < plan->n_audio_out; ++i) {
+			jack_port_t* jport = jalv->ports[plan->audio_out[i]].sys_port;
+			if (jport) {
+				memset(jack_port_get_buffer(jport, nframes),
+				       '\0', nframes * sizeof(float));
+			}
+		}
+		for (uint32_t i = 0; i < plan->n_event_out; ++i) {
+			jack_port_t* jport = jalv->ports[plan->event_out[i]].sys_port;
+			if (jport) {
+				jack_midi_clear_buffer(jack_port_get_buffer(jport, nframes));
+			}
+		}
+		return false;
+	default:
+		break;
+	}
+
+	/* Connect plugin audio and CV ports directly to Jack port buffers.  These
+	   are usually the same every cycle, in which case nothing is done. */
+	for (uint32_t i = 0; i < plan->n_audio_in; ++i) {
+		const uint32_t p = plan->audio_in[i];
+		if (jalv->ports[p].sys_port) {
+			jalv_connect_port(
+				jalv, p, jack_port_get_buffer(jalv->ports[p].sys_port, nframes));
+		}
+	}
+	for (uint32_t i = 0; i < plan->n_audio_out; ++i) {
+		const uint32_t p = plan->audio_out[i];
+		if (jalv->ports[p].sys_port) {
+			jalv_connect_port(
+				jalv, p, jack_port_get_buffer(jalv->ports[p].sys_port, nframes));
+		}
+	}
+
+	/* Prepare event input buffers */
+	for (uint32_t i = 0; i < plan->n_event_in; ++i) {
+		struct Port* const port = &jalv->ports[plan->event_in[i]];
+		lv2_evbuf_reset(port->evbuf, true);
+
+		/* Write transport change event if applicable */
+		LV2_Evbuf_Iterator iter = lv2_evbuf_begin(port->evbuf);
+		if (xport) {
+			lv2_evbuf_write(&iter, 0, 0,
+			                xport->type, xport->size,
+			                (const uint8_t*)LV2_ATOM_BODY_CONST(xport));
+		}
+
+		if (jalv->request_update) {
+			/* Plugin state has changed, request an update */
+			const LV2_Atom_Object get = {
+				{ sizeof(LV2_Atom_Object_Body), jalv->urids.atom_Object },
+				{ 0, jalv->urids.patch_Get } };
+			lv2_evbuf_write(&iter, 0, 0,
+			                get.atom.type, get.atom.size,
+			                (const uint8_t*)LV2_ATOM_BODY(&get));
+		}
+
+		if (port->sys_port) {
+			/* Copy Jack MIDI input directly into the sequence (in order) */
+			void*          buf      = jack_port_get_buffer(port->sys_port, nframes);
+			const uint32_t n_events = jack_midi_get_event_count(buf);
+			for (uint32_t e = 0; e < n_events; ++e) {
+				jack_midi_event_t ev;
+				jack_midi_event_get(&ev, buf, e);
+
+				uint8_t* const body = lv2_evbuf_reserve(
+					&iter, ev.time, 0, jalv->urids.midi_MidiEvent, ev.size);
+				if (!body) {
+					break;  // Buffer full, drop remaining events
+				}
+				memcpy(body, ev.buffer, ev.size);
+			}
+		}
+	}
+	jalv->request_update = false;
+
+	/* Clear event outputs for plugin to write to */
+	for (uint32_t i = 0; i < plan->n_event_out; ++i) {
+		lv2_evbuf_reset(jalv->ports[plan->event_out[i]].evbuf, false);
+	}
+
+	/* Run plugin for this cycle */
+	jalv_run(jalv, nframes);
+
+	/* Check for latency changes */
+	bool latency_changed = false;
+	if (plan->latency_port != UINT32_MAX) {
+		const float latency = jalv->ports[plan->latency_port].control;
+		if (jalv->plugin_latency != latency) {
+			jalv->plugin_latency = latency;
+			latency_changed      = true;
+		}
+	}
+
+	/* Deliver MIDI output and UI events */
+	for (uint32_t o = 0; o < plan->n_event_out; ++o) {
+		const uint32_t     p    = plan->event_out[o];
+		struct Port* const port = &jalv->ports[p];
+		void*              buf  = NULL;
+		if (port->sys_port) {
+			buf = jack_port_get_buffer(port->sys_port, nframes);
+			jack_midi_clear_buffer(buf);
+		}
+
+		for (LV2_Evbuf_Iterator i = lv2_evbuf_begin(port->evbuf);
+		     lv2_evbuf_is_valid(i);
+		     i = lv2_evbuf_next(i)) {
+			// Get event from LV2 buffer
+			uint32_t frames, subframes, type, size;
+			uint8_t* body;
+			lv2_evbuf_get(i, &frames, &subframes, &type, &size, &body);
+
+			if (buf && type == jalv->urids.midi_MidiEvent) {
+				// Write MIDI event to Jack output
+				jack_midi_event_write(buf, frames, body, size);
+			}
+
+			if (jalv->has_ui) {
+				// Forward event to UI
+				jalv_send_to_ui(jalv, p, type, size, body);
+			}
+		}
+	}
+
+	return latency_changed;
+}
+
+/** Process instances claimed from the DSP pool until none are left. */
+static REALTIME void
+jack_dsp_pool_run(Jalv* const jalv)
+{
+	JalvDspPool* const pool        = &jalv->backend->pool;
+	const uint32_t     n_instances = jalv->n_instances + 1;
+
+	uint32_t i = 0;
+	while ((i = zix_atomic_add(&pool->next, 1)) < n_instances) {
+		Jalv* const inst = i ? jalv->instances[i - 1] : jalv;
+		if (jack_process_instance(inst, pool->nframes, pool->xport)) {
+			zix_atomic_store(&pool->latency, 1);
+		}
+		if (zix_atomic_sub(&pool->remaining, 1) == 1) {
+			zix_sem_post(&pool->done); // Last instance of this cycle
+		}
+	}
+}
+
+/** DSP pool thread function. */
+static void*
+jack_dsp_pool_thread(void* data)
+{
+	Jalv* const        jalv = (Jalv*)data;
+	JalvDspPool* const pool = &jalv->backend->pool;
+	while (true) {
+		zix_sem_wait(&pool->start);
+		if (zix_atomic_load(&pool->exit)) {
+			break;
+		}
+
+		jack_dsp_pool_run(jalv);
+	}
+
+	return NULL;
+}
+
 /** Jack process callback. */
 static REALTIME int
 jack_process_cb(jack_nframes_t nframes, void* data)
@@ -122,144 +348,47 @@ jack_process_cb(jack_nframes_t nframes, void* data)
 	jalv->bpm      = pos.beats_per_minute;
 	jalv->rolling  = rolling;
 
-	switch (jalv->play_state) {
-	case JALV_PAUSE_REQUESTED:
-		jalv->play_state = JALV_PAUSED;
-		zix_sem_post(&jalv->paused);
-		break;
-	case JALV_PAUSED:
-		for (uint32_t p = 0; p < jalv->num_ports; ++p) {
-			jack_port_t* jport = jalv->ports[p].sys_port;
-			if (jport && jalv->ports[p].flow == FLOW_OUTPUT) {
-				void* buf = jack_port_get_buffer(jport, nframes);
-				if (jalv->ports[p].type == TYPE_EVENT) {
-					jack_midi_clear_buffer(buf);
-				} else {
-					memset(buf, '\0', nframes * sizeof(float));
-				}
-			}
+	const LV2_Atom* const xport   = xport_changed ? lv2_pos : NULL;
+	JalvDspPool* const    pool    = &jalv->backend->pool;
+	bool                  latency = false;
+	const uint32_t        users   = zix_atomic_add(&pool->users, 1);
+	if (!(users & JACK_DSP_POOL_CLOSED) && pool->n_threads) {
+		/* Publish cycle, wake pool threads, and join in processing */
+		pool->nframes = nframes;
+		pool->xport   = xport;
+		zix_atomic_store(&pool->latency, 0);
+		zix_atomic_store(&pool->remaining, jalv->n_instances + 1);
+		zix_atomic_store(&pool->next, 0);
+		for (uint32_t i = 0; i < pool->n_threads; ++i) {
+			zix_sem_post(&pool->start);
 		}
-		return 0;
-	default:
-		break;
-	}
 
-	/* Prepare port buffers */
-	for (uint32_t p = 0; p < jalv->num_ports; ++p) {
-		struct Port* port = &jalv->ports[p];
-		if (port->type == TYPE_AUDIO && port->sys_port) {
-			/* Connect plugin port directly to Jack port buffer */
-			lilv_instance_connect_port(
-				jalv->instance, p,
-				jack_port_get_buffer(port->sys_port, nframes));
-#ifdef HAVE_JACK_METADATA
-		} else if (port->type == TYPE_CV && port->sys_port) {
-			/* Connect plugin port directly to Jack port buffer */
-			lilv_instance_connect_port(
-				jalv->instance, p,
-				jack_port_get_buffer(port->sys_port, nframes));
-#endif
-		} else if (port->type == TYPE_EVENT && port->flow == FLOW_INPUT) {
-			lv2_evbuf_reset(port->evbuf, true);
-
-			/* Write transport change event if applicable */
-			LV2_Evbuf_Iterator iter = lv2_evbuf_begin(port->evbuf);
-			if (xport_changed) {
-				lv2_evbuf_write(&iter, 0, 0,
-				                lv2_pos->type, lv2_pos->size,
-				                (const uint8_t*)LV2_ATOM_BODY(lv2_pos));
-			}
+		jack_dsp_pool_run(jalv);
 
-			if (jalv->request_update) {
-				/* Plugin state has changed, request an update */
-				const LV2_Atom_Object get = {
-					{ sizeof(LV2_Atom_Object_Body), jalv->urids.atom_Object },
-					{ 0, jalv->urids.patch_Get } };
-				lv2_evbuf_write(&iter, 0, 0,
-				                get.atom.type, get.atom.size,
-				                (const uint8_t*)LV2_ATOM_BODY(&get));
-			}
+		/* Wait for instances still being processed by other threads */
+		zix_sem_wait(&pool->done);
 
-			if (port->sys_port) {
-				/* Write Jack MIDI input */
-				void* buf = jack_port_get_buffer(port->sys_port, nframes);
-				for (uint32_t i = 0; i < jack_midi_get_event_count(buf); ++i) {
-					jack_midi_event_t ev;
-					jack_midi_event_get(&ev, buf, i);
-					lv2_evbuf_write(&iter,
-					                ev.time, 0,
-					                jalv->urids.midi_MidiEvent,
-					                ev.size, ev.buffer);
-				}
-			}
-		} else if (port->type == TYPE_EVENT) {
-			/* Clear event output for plugin to write to */
-			lv2_evbuf_reset(port->evbuf, false);
+		latency = zix_atomic_load(&pool->latency);
+	} else {
+		/* Run the host instance, then any additional instances */
+		latency = jack_process_instance(jalv, nframes, xport);
+		for (uint32_t i = 0; i < jalv->n_instances; ++i) {
+			latency |= jack_process_instance(jalv->instances[i], nframes, xport);
 		}
 	}
-	jalv->request_update = false;
-
-	/* Run plugin for this cycle */
-	const bool send_ui_updates = jalv_run(jalv, nframes);
-
-	/* Deliver MIDI output and UI events */
-	for (uint32_t p = 0; p < jalv->num_ports; ++p) {
-		struct Port* const port = &jalv->ports[p];
-		if (port->flow == FLOW_OUTPUT && port->type == TYPE_CONTROL &&
-		    lilv_port_has_property(jalv->plugin, port->lilv_port,
-		                           jalv->nodes.lv2_reportsLatency)) {
-			if (jalv->plugin_latency != port->control) {
-				jalv->plugin_latency = port->control;
-				jack_recompute_total_latencies(client);
-			}
-		} else if (port->flow == FLOW_OUTPUT && port->type == TYPE_EVENT) {
-			void* buf = NULL;
-			if (port->sys_port) {
-				buf = jack_port_get_buffer(port->sys_port, nframes);
-				jack_midi_clear_buffer(buf);
-			}
+	zix_atomic_sub(&pool->users, 1);
 
-			for (LV2_Evbuf_Iterator i = lv2_evbuf_begin(port->evbuf);
-			     lv2_evbuf_is_valid(i);
-			     i = lv2_evbuf_next(i)) {
-				// Get event from LV2 buffer
-				uint32_t frames, subframes, type, size;
-				uint8_t* body;
-				lv2_evbuf_get(i, &frames, &subframes, &type, &size, &body);
-
-				if (buf && type == jalv->urids.midi_MidiEvent) {
-					// Write MIDI event to Jack output
-					jack_midi_event_write(buf, frames, body, size);
-				}
-
-				if (jalv->has_ui) {
-					// Forward event to UI
-					jalv_send_to_ui(jalv, p, type, size, body);
-				}
-			}
-		} else if (send_ui_updates &&
-		           port->flow == FLOW_OUTPUT && port->type == TYPE_CONTROL) {
-			char buf[sizeof(ControlChange) + sizeof(float)];
-			ControlChange* ev = (ControlChange*)buf;
-			ev->index    = p;
-			ev->protocol = 0;
-			ev->size     = sizeof(float);
-			*(float*)ev->body = port->control;
-			if (zix_ring_write(jalv->plugin_events, buf, sizeof(buf))
-			    < sizeof(buf)) {
-				fprintf(stderr, "Plugin => UI buffer overflow!\n");
-			}
-		}
+	if (latency) {
+		jack_recompute_total_latencies(client);
 	}
 
 	return 0;
 }
 
-/** Calculate latency assuming all ports depend on each other. */
+/** Calculate latency assuming all ports of an instance depend on each other. */
 static void
-jack_latency_cb(jack_latency_callback_mode_t mode, void* data)
+jack_instance_latency(Jalv* const jalv, jack_latency_callback_mode_t mode)
 {
-	Jalv* const         jalv = (Jalv*)data;
 	const enum PortFlow flow = ((mode == JackCaptureLatency)
 	                            ? FLOW_INPUT : FLOW_OUTPUT);
 
@@ -294,6 +423,17 @@ jack_latency_cb(jack_latency_callback_mode_t mode, void* data)
 	}
 }
 
+/** Jack latency callback. */
+static void
+jack_latency_cb(jack_latency_callback_mode_t mode, void* data)
+{
+	Jalv* const jalv = (Jalv*)data;
+	jack_instance_latency(jalv, mode);
+	for (uint32_t i = 0; i < jalv->n_instances; ++i) {
+		jack_instance_latency(jalv->instances[i], mode);
+	}
+}
+
 #ifdef JALV_JACK_SESSION
 static void
 jack_session_cb(jack_session_event_t* event, void* arg)
@@ -428,7 +568,44 @@ jalv_backend_close(Jalv* jalv)
 void
 jalv_backend_activate(Jalv* jalv)
 {
-	jack_activate(jalv->backend->client);
+	jack_client_t* const client = jalv->backend->client;
+	JalvDspPool* const   pool   = &jalv->backend->pool;
+
+	/* Launch a thread for every additional instance, up to one per core */
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	const long n_cpus = (long)info.dwNumberOfProcessors;
+#else
+	const long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+	if (jalv->n_instances && n_cpus > 1) {
+		const uint32_t max_threads = (uint32_t)n_cpus - 1;
+		const uint32_t n_threads   = (jalv->n_instances < max_threads)
+			? jalv->n_instances
+			: max_threads;
+
+		zix_sem_init(&pool->start, 0);
+		zix_sem_init(&pool->done, 0);
+		zix_atomic_store(&pool->users, 0);
+		pool->threads = (jack_native_thread_t*)calloc(
+			n_threads, sizeof(jack_native_thread_t));
+		for (uint32_t i = 0; i < n_threads; ++i) {
+			if (jack_client_create_thread(client,
+			                              &pool->threads[pool->n_threads],
+			                              jack_client_real_time_priority(client),
+			                              jack_is_realtime(client),
+			                              jack_dsp_pool_thread,
+			                              jalv)) {
+				fprintf(stderr, "warning: Failed to create DSP thread\n");
+				break;
+			}
+			++pool->n_threads;
+		}
+		printf("DSP threads:  %u\n", pool->n_threads + 1);
+	}
+
+	jack_activate(client);
 }
 
 void
@@ -437,6 +614,60 @@ jalv_backend_deactivate(Jalv* jalv)
 	if (jalv->backend && !jalv->backend->is_internal_client) {
 		jack_deactivate(jalv->backend->client);
 	}
+
+	if (jalv->backend && jalv->backend->pool.threads) {
+		/* Stop DSP pool, the process thread can process everything alone */
+		JalvDspPool* const pool = &jalv->backend->pool;
+
+		/* Close pool and wait for a running process callback to leave it */
+		zix_atomic_add(&pool->users, JACK_DSP_POOL_CLOSED);
+		while (zix_atomic_load(&pool->users) != JACK_DSP_POOL_CLOSED) {
+#ifdef _WIN32
+			Sleep(1);
+#else
+			const struct timespec delay = { 0, 1000000 };
+			nanosleep(&delay, NULL);
+#endif
+		}
+
+		zix_atomic_store(&pool->exit, 1);
+		for (uint32_t i = 0; i < pool->n_threads; ++i) {
+			zix_sem_post(&pool->start);
+		}
+		for (uint32_t i = 0; i < pool->n_threads; ++i) {
+			zix_thread_join(pool->threads[i], NULL);
+		}
+
+		free(pool->threads);
+		pool->threads   = NULL;
+		pool->n_threads = 0;
+		zix_sem_destroy(&pool->start);
+		zix_sem_destroy(&pool->done);
+	}
+}
+
+/**
+   Register a Jack port for a plugin port.
+
+   Ports of additional instances are prefixed with the instance index, so
+   several instances of the same plugin can share a client.
+*/
+static jack_port_t*
+jack_register_port(jack_client_t* const  client,
+                   Jalv* const           jalv,
+                   const LilvNode* const sym,
+                   const char* const     type,
+                   enum JackPortFlags    flags)
+{
+	char name[256];
+	if (jalv->instance_index) {
+		snprintf(name, sizeof(name), "%u_%s",
+		         jalv->instance_index, lilv_node_as_string(sym));
+	} else {
+		snprintf(name, sizeof(name), "%s", lilv_node_as_string(sym));
+	}
+
+	return jack_port_register(client, name, type, flags, 0);
 }
 
 void
@@ -464,15 +695,13 @@ jalv_backend_activate_port(Jalv* jalv, uint32_t port_index)
 		lilv_instance_connect_port(jalv->instance, port_index, &port->control);
 		break;
 	case TYPE_AUDIO:
-		port->sys_port = jack_port_register(
-			client, lilv_node_as_string(sym),
-			JACK_DEFAULT_AUDIO_TYPE, jack_flags, 0);
+		port->sys_port = jack_register_port(
+			client, jalv, sym, JACK_DEFAULT_AUDIO_TYPE, jack_flags);
 		break;
 #ifdef HAVE_JACK_METADATA
 	case TYPE_CV:
-		port->sys_port = jack_port_register(
-			client, lilv_node_as_string(sym),
-			JACK_DEFAULT_AUDIO_TYPE, jack_flags, 0);
+		port->sys_port = jack_register_port(
+			client, jalv, sym, JACK_DEFAULT_AUDIO_TYPE, jack_flags);
 		if (port->sys_port) {
 			jack_set_property(client, jack_port_uuid(port->sys_port),
 			                  "http://jackaudio.org/metadata/signal-type", "CV",
@@ -483,9 +712,8 @@ jalv_backend_activate_port(Jalv* jalv, uint32_t port_index)
 	case TYPE_EVENT:
 		if (lilv_port_supports_event(
 			    jalv->plugin, port->lilv_port, jalv->nodes.midi_MidiEvent)) {
-			port->sys_port = jack_port_register(
-				client, lilv_node_as_string(sym),
-				JACK_DEFAULT_MIDI_TYPE, jack_flags, 0);
+			port->sys_port = jack_register_port(
+				client, jalv, sym, JACK_DEFAULT_MIDI_TYPE, jack_flags);
 		}
 		break;
 	default:
@@ -494,9 +722,10 @@ jalv_backend_activate_port(Jalv* jalv, uint32_t port_index)
 
 #ifdef HAVE_JACK_METADATA
 	if (port->sys_port) {
-		// Set port order to index
+		// Set port order to index, with each instance after the previous
 		char index_str[16];
-		snprintf(index_str, sizeof(index_str), "%d", port_index);
+		snprintf(index_str, sizeof(index_str), "%u",
+		         (jalv->instance_index << 16) + port_index);
 		jack_set_property(client, jack_port_uuid(port->sys_port),
 		                  "http://jackaudio.org/metadata/order", index_str,
 		                  "http://www.w3.org/2001/XMLSchema#integer");
@@ -507,6 +736,24 @@ jalv_backend_activate_port(Jalv* jalv, uint32_t port_index)
 		                  JACK_METADATA_PRETTY_NAME, lilv_node_as_string(name),
 		                  "text/plain");
 		lilv_node_free(name);
+
+		// Group ports by instance if several are hosted in this client
+		if (jalv->host || jalv->opts.instances) {
+			LilvNode* plugin_name = lilv_plugin_get_name(jalv->plugin);
+			char      group[256];
+			if (jalv->instance_index) {
+				snprintf(group, sizeof(group), "%s (%u)",
+				         lilv_node_as_string(plugin_name),
+				         jalv->instance_index);
+			} else {
+				snprintf(group, sizeof(group), "%s",
+				         lilv_node_as_string(plugin_name));
+			}
+			jack_set_property(client, jack_port_uuid(port->sys_port),
+			                  "http://jackaudio.org/metadata/port-group",
+			                  group, "text/plain");
+			lilv_node_free(plugin_name);
+		}
 	}
 #endif
 }
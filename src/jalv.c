@@ -18,8 +18,10 @@
 #define _DARWIN_C_SOURCE        /* for mkdtemp on OSX */
 
 #include <assert.h>
+#include <inttypes.h>
 #include <math.h>
 #include <signal.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -64,8 +66,9 @@
 #include "lv2_evbuf.h"
 #include "worker.h"
 
-#define NS_RDF "http://www.w3.org/1999/02/22-rdf-syntax-ns#"
-#define NS_XSD "http://www.w3.org/2001/XMLSchema#"
+#define NS_JALV "http://drobilla.net/ns/jalv#"
+#define NS_RDF  "http://www.w3.org/1999/02/22-rdf-syntax-ns#"
+#define NS_XSD  "http://www.w3.org/2001/XMLSchema#"
 
 #ifndef MIN
 #    define MIN(a, b) (((a) < (b)) ? (a) : (b))
@@ -79,13 +82,6 @@
 #    define ARRAY_SIZE(arr) (sizeof(arr) / sizeof(arr[0]))
 #endif
 
-/* Size factor for UI ring buffers.  The ring size is a few times the size of
-   an event output to give the UI a chance to keep up.  Experiments with Ingen,
-   which can highly saturate its event output, led me to this value.  It
-   really ought to be enough for anybody(TM).
-*/
-#define N_BUFFER_CYCLES 16
-
 static ZixSem* exit_sem = NULL;  /**< Exit semaphore used by signal handler*/
 
 static LV2_URID
@@ -93,9 +89,16 @@ map_uri(LV2_URID_Map_Handle handle,
         const char*         uri)
 {
 	Jalv* jalv = (Jalv*)handle;
-	zix_sem_wait(&jalv->symap_lock);
-	const LV2_URID id = symap_map(jalv->symap, uri);
-	zix_sem_post(&jalv->symap_lock);
+
+	/* Already mapped URIs are found without locking, which is real-time safe
+	   so plugins may map from run() or work() */
+	LV2_URID id = symap_try_map(jalv->symap, uri);
+	if (!id) {
+		/* Add new URI, symap_map() searches again in case of a race */
+		zix_sem_wait(&jalv->symap_lock);
+		id = symap_map(jalv->symap, uri);
+		zix_sem_post(&jalv->symap_lock);
+	}
 	return id;
 }
 
@@ -104,10 +107,7 @@ unmap_uri(LV2_URID_Unmap_Handle handle,
           LV2_URID              urid)
 {
 	Jalv* jalv = (Jalv*)handle;
-	zix_sem_wait(&jalv->symap_lock);
-	const char* uri = symap_unmap(jalv->symap, urid);
-	zix_sem_post(&jalv->symap_lock);
-	return uri;
+	return symap_unmap(jalv->symap, urid);
 }
 
 #define NS_EXT "http://lv2plug.in/ns/ext/"
@@ -158,6 +158,7 @@ create_port(Jalv*    jalv,
 	port->lilv_port = lilv_plugin_get_port_by_index(jalv->plugin, port_index);
 	port->sys_port  = NULL;
 	port->evbuf     = NULL;
+	port->buffer    = NULL;
 	port->buf_size  = 0;
 	port->index     = port_index;
 	port->control   = 0.0f;
@@ -260,12 +261,74 @@ jalv_allocate_port_buffers(Jalv* jalv)
 				              lilv_node_as_string(jalv->nodes.atom_Sequence)));
 			lilv_instance_connect_port(
 				jalv->instance, i, lv2_evbuf_get_buffer(port->evbuf));
+
+			if (jalv->opts.min_slice) {
+				/* Allocate buffer for splitting runs at control changes */
+				lv2_evbuf_free(port->sub_evbuf);
+				port->sub_evbuf = lv2_evbuf_new(
+					buf_size,
+					jalv->map.map(jalv->map.handle,
+					              lilv_node_as_string(jalv->nodes.atom_Chunk)),
+					jalv->map.map(jalv->map.handle,
+					              lilv_node_as_string(jalv->nodes.atom_Sequence)));
+			}
 		}
 		default: break;
 		}
 	}
 }
 
+void
+jalv_build_process_plan(Jalv* jalv)
+{
+	JalvProcessPlan* const plan = &jalv->plan;
+
+	/* Allocate every list with room for all ports in a single block */
+	free(plan->audio_in);
+	memset(plan, 0, sizeof(JalvProcessPlan));
+	plan->audio_in     = (uint32_t*)calloc(5 * (size_t)jalv->num_ports + 1,
+	                                       sizeof(uint32_t));
+	plan->audio_out    = plan->audio_in + jalv->num_ports;
+	plan->event_in     = plan->audio_out + jalv->num_ports;
+	plan->event_out    = plan->event_in + jalv->num_ports;
+	plan->control_out  = plan->event_out + jalv->num_ports;
+	plan->latency_port = UINT32_MAX;
+
+	for (uint32_t i = 0; i < jalv->num_ports; ++i) {
+		const struct Port* const port = &jalv->ports[i];
+		const bool               in   = port->flow == FLOW_INPUT;
+		const bool               out  = port->flow == FLOW_OUTPUT;
+		switch (port->type) {
+		case TYPE_AUDIO:
+		case TYPE_CV:
+			if (in) {
+				plan->audio_in[plan->n_audio_in++] = i;
+			} else if (out) {
+				plan->audio_out[plan->n_audio_out++] = i;
+			}
+			break;
+		case TYPE_EVENT:
+			if (in) {
+				plan->event_in[plan->n_event_in++] = i;
+			} else if (out) {
+				plan->event_out[plan->n_event_out++] = i;
+			}
+			break;
+		case TYPE_CONTROL:
+			if (out && plan->latency_port == UINT32_MAX &&
+			    lilv_port_has_property(jalv->plugin, port->lilv_port,
+			                           jalv->nodes.lv2_reportsLatency)) {
+				plan->latency_port = i;
+			} else if (out) {
+				plan->control_out[plan->n_control_out++] = i;
+			}
+			break;
+		default:
+			break;
+		}
+	}
+}
+
 /**
    Get a port structure by symbol.
 
@@ -361,11 +424,25 @@ jalv_set_control(const ControlID* control,
                  uint32_t         size,
                  LV2_URID         type,
                  const void*      body)
+{
+	jalv_set_control_at(control, 0, size, type, body);
+}
+
+void
+jalv_set_control_at(const ControlID* control,
+                    uint64_t         time,
+                    uint32_t         size,
+                    LV2_URID         type,
+                    const void*      body)
 {
 	Jalv* jalv = control->jalv;
 	if (control->type == PORT && type == jalv->forge.Float) {
-		struct Port* port = &control->jalv->ports[control->index];
-		port->control = *(const float*)body;
+		if (time) {
+			jalv_ui_write_at(jalv, time, control->index, size, 0, body);
+		} else {
+			struct Port* port = &control->jalv->ports[control->index];
+			port->control = *(const float*)body;
+		}
 	} else if (control->type == PROPERTY) {
 		// Copy forge since it is used by process thread
 		LV2_Atom_Forge       forge = jalv->forge;
@@ -381,11 +458,52 @@ jalv_set_control(const ControlID* control,
 		lv2_atom_forge_write(&forge, body, size);
 
 		const LV2_Atom* atom = lv2_atom_forge_deref(&forge, frame.ref);
-		jalv_ui_write(jalv,
-		              jalv->control_in,
-		              lv2_atom_total_size(atom),
-		              jalv->urids.atom_eventTransfer,
-		              atom);
+		jalv_ui_write_at(jalv,
+		                 time,
+		                 jalv->control_in,
+		                 lv2_atom_total_size(atom),
+		                 jalv->urids.atom_eventTransfer,
+		                 atom);
+	}
+}
+
+/** Return the current wall clock and process CPU time. */
+static JalvTimestamp
+jalv_timestamp(void)
+{
+	const JalvTimestamp now = {
+		jalv_time_us(),
+		(uint64_t)clock() * 1000000u / CLOCKS_PER_SEC
+	};
+	return now;
+}
+
+/** Print the time taken by a startup phase since `start`, iff -T is given. */
+static void
+jalv_print_phase(const Jalv* jalv, const char* name, JalvTimestamp start)
+{
+	if (jalv->opts.timings) {
+		const JalvTimestamp now = jalv_timestamp();
+		char                prefixed[64];
+		if (jalv->instance_index) {
+			snprintf(prefixed, sizeof(prefixed), "%u_%s",
+			         jalv->instance_index, name);
+			name = prefixed;
+		}
+		fprintf(stderr, "Time:         %-22s %10.3f ms wall %10.3f ms CPU\n",
+		        name,
+		        (double)(now.wall - start.wall) / 1000.0,
+		        (double)(now.cpu - start.cpu) / 1000.0);
+	}
+}
+
+/** Finish the current startup phase and start the next. */
+static void
+jalv_phase(Jalv* jalv, const char* name)
+{
+	if (jalv->opts.timings) {
+		jalv_print_phase(jalv, name, jalv->phase_start);
+		jalv->phase_start = jalv_timestamp();
 	}
 }
 
@@ -393,6 +511,8 @@ void
 jalv_ui_instantiate(Jalv* jalv, const char* native_ui_type, void* parent)
 {
 #ifdef HAVE_SUIL
+	const JalvTimestamp start = jalv_timestamp();
+
 	jalv->ui_host = suil_host_new(jalv_ui_write, jalv_ui_port_index, NULL, NULL);
 
 	const LV2_Feature parent_feature = {
@@ -437,6 +557,7 @@ jalv_ui_instantiate(Jalv* jalv, const char* native_ui_type, void* parent)
 
 	lilv_free(binary_path);
 	lilv_free(bundle_path);
+	jalv_print_phase(jalv, "ui_instantiation", start);
 #endif
 }
 
@@ -471,8 +592,18 @@ jalv_ui_write(void* const    jalv_handle,
               uint32_t       protocol,
               const void*    buffer)
 {
-	Jalv* const jalv = (Jalv*)jalv_handle;
+	jalv_ui_write_at((Jalv*)jalv_handle, 0,
+	                 port_index, buffer_size, protocol, buffer);
+}
 
+void
+jalv_ui_write_at(Jalv*       jalv,
+                 uint64_t    time,
+                 uint32_t    port_index,
+                 uint32_t    buffer_size,
+                 uint32_t    protocol,
+                 const void* buffer)
+{
 	if (protocol != 0 && protocol != jalv->urids.atom_eventTransfer) {
 		fprintf(stderr, "UI write with unsupported protocol %d (%s)\n",
 		        protocol, unmap_uri(jalv, protocol));
@@ -496,46 +627,335 @@ jalv_ui_write(void* const    jalv_handle,
 		free(str);
 	}
 
-	char buf[sizeof(ControlChange) + buffer_size];
-	ControlChange* ev = (ControlChange*)buf;
-	ev->index    = port_index;
-	ev->protocol = protocol;
-	ev->size     = buffer_size;
-	memcpy(ev->body, buffer, buffer_size);
-	zix_ring_write(jalv->ui_events, buf, sizeof(buf));
+	/* Write event directly into the ring */
+	const ControlChange ev = { time, port_index, protocol, buffer_size, 0 };
+	if (!jalv_ring_write_message(
+		    jalv->ui_events, &ev, sizeof(ev), buffer, buffer_size)) {
+		zix_atomic_add(&jalv->n_ui_drops, 1);
+		fprintf(stderr, "warning: UI => Plugin buffer overflow\n");
+	}
+}
+
+/** Apply a single UI event `frames` into the current cycle. */
+static void
+jalv_apply_ui_event(Jalv* jalv, const ControlChange* ev, uint32_t frames)
+{
+	assert(ev->index < jalv->num_ports);
+	struct Port* const port = &jalv->ports[ev->index];
+
+	/* Work scheduled in response to the user is more urgent */
+	if (jalv->worker.priority > JALV_WORK_INTERACTIVE) {
+		jalv->worker.priority = JALV_WORK_INTERACTIVE;
+	}
+
+	if (ev->protocol == 0) {
+		assert(ev->size == sizeof(float));
+		port->control = *(const float*)ev->body;
+	} else if (ev->protocol == jalv->urids.atom_eventTransfer) {
+		/* Insert after any events at or before this time, so the sequence
+		   stays in time order with transport and MIDI input */
+		const LV2_Atom* const atom = (const LV2_Atom*)ev->body;
+		lv2_evbuf_insert(port->evbuf, frames, 0, atom->type, atom->size,
+		                 (const uint8_t*)LV2_ATOM_BODY_CONST(atom));
+	} else {
+		fprintf(stderr, "error: Unknown control change protocol %d\n",
+		        ev->protocol);
+	}
+}
+
+/** Return the size of `ev` in the pending queue, padded to 64 bits. */
+static inline uint32_t
+jalv_pending_size(const ControlChange* ev)
+{
+	return lv2_atom_pad_size(sizeof(ControlChange) + ev->size);
+}
+
+/**
+   Return true iff `ev` is applied now, `offset` frames into this cycle.
+
+   Control port changes later in this cycle are not due, so they can be
+   applied when a sub-run starts there.  The offset of `ev` in this cycle is
+   returned in `frames`, or 0 if it is scheduled before this cycle.
+*/
+static bool
+jalv_ui_event_is_due(const Jalv*          jalv,
+                     const ControlChange* ev,
+                     uint32_t             nframes,
+                     uint32_t             offset,
+                     uint32_t*            frames)
+{
+	const uint64_t start = jalv->frame_time;
+	const uint64_t end   = start + nframes;
+
+	*frames = (ev->time > start && ev->time < end)
+		? (uint32_t)(ev->time - start) : 0;
+
+	return ev->time < end && (ev->protocol != 0 || *frames <= offset);
+}
+
+/**
+   Insert `ev` into the pending queue after events scheduled at or before it.
+
+   Events scheduled in the past are applied at the start of the next cycle, so
+   they are ordered as if scheduled then, which keeps them in arrival order.
+
+   If `evict` is true, events scheduled after `ev` are dropped if necessary to
+   make room for it, so later events can not prevent earlier ones from being
+   queued.
+
+   @return True iff `ev` was queued.
+*/
+static bool
+jalv_queue_ui_event(Jalv* jalv, const ControlChange* ev, bool evict)
+{
+	const uint64_t now    = jalv->frame_time;
+	const uint64_t time   = (ev->time > now) ? ev->time : now;
+	const uint32_t padded = jalv_pending_size(ev);
+
+	/* Find the first event scheduled later than `ev` */
+	uint32_t pos = 0;
+	while (pos < jalv->ui_pending_len) {
+		const ControlChange* const e = (const ControlChange*)(
+			jalv->ui_pending + pos);
+		if (e->time > time) {
+			break;
+		}
+		pos += jalv_pending_size(e);
+	}
+
+	if (jalv->ui_pending_len + padded > jalv->ui_pending_cap) {
+		if (!evict || pos + padded > jalv->ui_pending_cap) {
+			return false;
+		}
+
+		/* Keep as many of the later events as fit after `ev` */
+		uint32_t len = pos;
+		while (len < jalv->ui_pending_len) {
+			const ControlChange* const e = (const ControlChange*)(
+				jalv->ui_pending + len);
+			const uint32_t e_padded = jalv_pending_size(e);
+			if (len + e_padded + padded > jalv->ui_pending_cap) {
+				break;
+			}
+			len += e_padded;
+		}
+
+		for (uint32_t i = len; i < jalv->ui_pending_len;) {
+			const ControlChange* const e = (const ControlChange*)(
+				jalv->ui_pending + i);
+			i += jalv_pending_size(e);
+			zix_atomic_add(&jalv->n_ui_drops, 1);
+		}
+		jalv->ui_pending_len = len;
+	}
+
+	memmove(jalv->ui_pending + pos + padded,
+	        jalv->ui_pending + pos,
+	        jalv->ui_pending_len - pos);
+	memcpy(jalv->ui_pending + pos, ev, sizeof(ControlChange) + ev->size);
+	jalv->ui_pending_len += padded;
+	return true;
+}
+
+/**
+   Apply pending UI events that fall in this cycle, keeping later ones in order.
+
+   Control port changes after `offset` frames into the cycle are also kept, so
+   they can be applied when a sub-run starts there.
+
+   @return The offset of the next kept control port change in this cycle, or
+   `nframes` if there is none.
+*/
+static uint32_t
+jalv_apply_pending_events(Jalv* jalv, uint32_t nframes, uint32_t offset)
+{
+	const uint64_t end  = jalv->frame_time + nframes;
+	uint32_t       next = nframes;
+	uint32_t       kept = 0;
+	for (uint32_t i = 0; i < jalv->ui_pending_len;) {
+		ControlChange* const ev     = (ControlChange*)(jalv->ui_pending + i);
+		const uint32_t       padded = jalv_pending_size(ev);
+		uint32_t             frames = 0;
+
+		if (!jalv_ui_event_is_due(jalv, ev, nframes, offset, &frames)) {
+			if (ev->time < end && frames < next) {
+				next = frames;
+			}
+			if (kept != i) {
+				memmove(jalv->ui_pending + kept, ev, padded);
+			}
+			kept += padded;
+		} else {
+			jalv_apply_ui_event(jalv, ev, frames);
+		}
+		i += padded;
+	}
+	jalv->ui_pending_len = kept;
+	return next;
+}
+
+/**
+   Move new events from the UI ring into the pending queue in time order.
+
+   Events scheduled for later cycles can not block ones that are due: if the
+   queue is full, the due events in it are applied to make room, and a new
+   event that is due is applied directly.  A new event that is not due
+   replaces events scheduled after it, or is dropped if there are none.
+*/
+static void
+jalv_read_ui_events(Jalv* jalv, uint32_t nframes, uint32_t offset)
+{
+	/* Each event is read to the scratch space after the queue, which is
+	   64-bit aligned so it can be accessed in place */
+	uint8_t* const scratch = jalv->ui_pending + jalv->ui_pending_cap;
+	ControlChange  header;
+	uint32_t       space = zix_ring_read_space(jalv->ui_events);
+	while (space >= sizeof(header)) {
+		zix_ring_peek(jalv->ui_events, (char*)&header, sizeof(header));
+		const uint32_t size = sizeof(header) + header.size;
+		if (zix_ring_read(jalv->ui_events, scratch, size) != size) {
+			fprintf(stderr, "error: Error reading from UI ring buffer\n");
+			break;
+		}
+		space -= size;
+
+		const ControlChange* const ev = (const ControlChange*)scratch;
+		if (!jalv_queue_ui_event(jalv, ev, false)) {
+			uint32_t frames = 0;
+			jalv_apply_pending_events(jalv, nframes, offset);
+			if (jalv_ui_event_is_due(jalv, ev, nframes, offset, &frames)) {
+				jalv_apply_ui_event(jalv, ev, frames);
+			} else if (!jalv_queue_ui_event(jalv, ev, true)) {
+				zix_atomic_add(&jalv->n_ui_drops, 1);
+			}
+		}
+	}
 }
 
 void
 jalv_apply_ui_events(Jalv* jalv, uint32_t nframes)
 {
-	if (!jalv->has_ui) {
+	jalv_read_ui_events(jalv, nframes, nframes);
+	jalv_apply_pending_events(jalv, nframes, nframes);
+}
+
+/** Run the plugin for `nframes` frames starting `offset` into the cycle. */
+static void
+jalv_run_slice(Jalv* jalv, uint32_t offset, uint32_t nframes)
+{
+	const JalvProcessPlan* const plan = &jalv->plan;
+
+	/* Connect audio and CV ports to the slice of their buffers */
+	for (uint32_t i = 0; i < plan->n_audio_in + plan->n_audio_out; ++i) {
+		const uint32_t     p    = (i < plan->n_audio_in)
+			? plan->audio_in[i] : plan->audio_out[i - plan->n_audio_in];
+		struct Port* const port = &jalv->ports[p];
+		if (port->buffer) {
+			lilv_instance_connect_port(jalv->instance, p,
+			                           (float*)port->buffer + offset);
+		}
+	}
+
+	/* Copy input events in the slice to the start of the slice buffer */
+	for (uint32_t i = 0; i < plan->n_event_in; ++i) {
+		struct Port* const port = &jalv->ports[plan->event_in[i]];
+		lv2_evbuf_reset(port->sub_evbuf, true);
+		LV2_Evbuf_Iterator out = lv2_evbuf_begin(port->sub_evbuf);
+		for (LV2_Evbuf_Iterator e = lv2_evbuf_begin(port->evbuf);
+		     lv2_evbuf_is_valid(e);
+		     e = lv2_evbuf_next(e)) {
+			uint32_t frames, subframes, type, size;
+			uint8_t* body;
+			lv2_evbuf_get(e, &frames, &subframes, &type, &size, &body);
+			if (frames >= offset + nframes) {
+				break;
+			} else if (frames >= offset) {
+				lv2_evbuf_write(&out, frames - offset, subframes,
+				                type, size, body);
+			}
+		}
+		lilv_instance_connect_port(jalv->instance, plan->event_in[i],
+		                           lv2_evbuf_get_buffer(port->sub_evbuf));
+	}
+
+	for (uint32_t i = 0; i < plan->n_event_out; ++i) {
+		struct Port* const port = &jalv->ports[plan->event_out[i]];
+		lv2_evbuf_reset(port->sub_evbuf, false);
+		lilv_instance_connect_port(jalv->instance, plan->event_out[i],
+		                           lv2_evbuf_get_buffer(port->sub_evbuf));
+	}
+
+	lilv_instance_run(jalv->instance, nframes);
+
+	/* Append output events to the cycle buffer at their time in the cycle */
+	for (uint32_t i = 0; i < plan->n_event_out; ++i) {
+		struct Port* const port = &jalv->ports[plan->event_out[i]];
+		LV2_Evbuf_Iterator out  = lv2_evbuf_end(port->evbuf);
+		for (LV2_Evbuf_Iterator e = lv2_evbuf_begin(port->sub_evbuf);
+		     lv2_evbuf_is_valid(e);
+		     e = lv2_evbuf_next(e)) {
+			uint32_t frames, subframes, type, size;
+			uint8_t* body;
+			lv2_evbuf_get(e, &frames, &subframes, &type, &size, &body);
+			if (!lv2_evbuf_write(&out, frames + offset, subframes,
+			                     type, size, body)) {
+				break;
+			}
+		}
+	}
+}
+
+/**
+   Run the plugin for a cycle, split into sub-runs at control port changes.
+
+   Each sub-run is at least `min_slice` frames long, except the last, so a
+   change may be applied up to `min_slice - 1` frames late.
+*/
+static void
+jalv_run_split(Jalv* jalv, uint32_t nframes)
+{
+	const JalvProcessPlan* const plan      = &jalv->plan;
+	const uint32_t               min_slice = jalv->opts.min_slice;
+
+	jalv_read_ui_events(jalv, nframes, 0);
+	uint32_t next = jalv_apply_pending_events(jalv, nframes, 0);
+	if (next >= nframes) {
+		/* No changes in this cycle after the start, run it whole */
+		lilv_instance_run(jalv->instance, nframes);
 		return;
 	}
 
-	ControlChange ev;
-	const size_t  space = zix_ring_read_space(jalv->ui_events);
-	for (size_t i = 0; i < space; i += sizeof(ev) + ev.size) {
-		zix_ring_read(jalv->ui_events, (char*)&ev, sizeof(ev));
-		char body[ev.size];
-		if (zix_ring_read(jalv->ui_events, body, ev.size) != ev.size) {
-			fprintf(stderr, "error: Error reading from UI ring buffer\n");
-			break;
+	for (uint32_t i = 0; i < plan->n_event_out; ++i) {
+		lv2_evbuf_reset(jalv->ports[plan->event_out[i]].evbuf, true);
+	}
+
+	for (uint32_t offset = 0; offset < nframes;) {
+		uint32_t end = (next > offset + min_slice) ? next : offset + min_slice;
+		if (end > nframes) {
+			end = nframes;
 		}
-		assert(ev.index < jalv->num_ports);
-		struct Port* const port = &jalv->ports[ev.index];
-		if (ev.protocol == 0) {
-			assert(ev.size == sizeof(float));
-			port->control = *(float*)body;
-		} else if (ev.protocol == jalv->urids.atom_eventTransfer) {
-			LV2_Evbuf_Iterator    e    = lv2_evbuf_end(port->evbuf);
-			const LV2_Atom* const atom = (const LV2_Atom*)body;
-			lv2_evbuf_write(&e, nframes, 0, atom->type, atom->size,
-			                (const uint8_t*)LV2_ATOM_BODY_CONST(atom));
-		} else {
-			fprintf(stderr, "error: Unknown control change protocol %d\n",
-			        ev.protocol);
+
+		jalv_run_slice(jalv, offset, end - offset);
+		if ((offset = end) < nframes) {
+			next = jalv_apply_pending_events(jalv, nframes, offset);
+		}
+	}
+
+	/* Reconnect ports to the cycle buffers for the next cycle */
+	for (uint32_t i = 0; i < plan->n_audio_in + plan->n_audio_out; ++i) {
+		const uint32_t     p    = (i < plan->n_audio_in)
+			? plan->audio_in[i] : plan->audio_out[i - plan->n_audio_in];
+		struct Port* const port = &jalv->ports[p];
+		if (port->buffer) {
+			lilv_instance_connect_port(jalv->instance, p, port->buffer);
 		}
 	}
+	for (uint32_t i = 0; i < plan->n_event_in + plan->n_event_out; ++i) {
+		const uint32_t p = (i < plan->n_event_in)
+			? plan->event_in[i] : plan->event_out[i - plan->n_event_in];
+		lilv_instance_connect_port(jalv->instance, p,
+		                           lv2_evbuf_get_buffer(jalv->ports[p].evbuf));
+	}
 }
 
 uint32_t
@@ -585,34 +1005,144 @@ jalv_send_to_ui(Jalv*       jalv,
                 const void* body)
 {
 	/* TODO: Be more disciminate about what to send */
-	char evbuf[sizeof(ControlChange) + sizeof(LV2_Atom)];
-	ControlChange* ev = (ControlChange*)evbuf;
-	ev->index    = port_index;
-	ev->protocol = jalv->urids.atom_eventTransfer;
-	ev->size     = sizeof(LV2_Atom) + size;
-
-	LV2_Atom* atom = (LV2_Atom*)ev->body;
-	atom->type = type;
-	atom->size = size;
-
-	if (zix_ring_write_space(jalv->plugin_events) >= sizeof(evbuf) + size) {
-		zix_ring_write(jalv->plugin_events, evbuf, sizeof(evbuf));
-		zix_ring_write(jalv->plugin_events, (const char*)body, size);
+	static const uint8_t pad[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+
+	/* Events are padded so that every event in the ring is 64-bit aligned,
+	   which allows jalv_update() to read them in place */
+	const uint32_t      atom_size = sizeof(LV2_Atom) + size;
+	const ControlChange ev        = { 0,
+	                                  port_index,
+	                                  jalv->urids.atom_eventTransfer,
+	                                  lv2_atom_pad_size(atom_size),
+	                                  0 };
+	const LV2_Atom      atom      = { size, type };
+	const uint32_t      ev_size   = sizeof(ControlChange) + ev.size;
+
+	/* Write event directly into the ring, and commit it all at once.  The
+	   atom is written at ev->body, which immediately follows the header. */
+	assert(offsetof(ControlChange, body) == sizeof(ev));
+	ZixRingVector vec;
+	if (zix_ring_reserve(jalv->plugin_events, ev_size, &vec)) {
+		zix_ring_vector_write(&vec, 0, &ev, sizeof(ev));
+		zix_ring_vector_write(&vec, sizeof(ev), &atom, sizeof(atom));
+		zix_ring_vector_write(&vec, sizeof(ev) + sizeof(atom), body, size);
+		zix_ring_vector_write(&vec, sizeof(ev) + atom_size, pad,
+		                      ev.size - atom_size);
+		zix_ring_commit(jalv->plugin_events, ev_size);
 		return true;
 	} else {
-		fprintf(stderr, "Plugin => UI buffer overflow!\n");
+		jalv_count_drop(jalv, port_index);
 		return false;
 	}
 }
 
+/**
+   Connect the ports of `instance` like those of the running instance.
+
+   Control ports are connected only if `controls` is true, since they are
+   connected once rather than every cycle.
+*/
+static void
+jalv_connect_instance(Jalv* jalv, LilvInstance* instance, bool controls)
+{
+	for (uint32_t p = 0; p < jalv->num_ports; ++p) {
+		struct Port* const port = &jalv->ports[p];
+		if (port->type == TYPE_CONTROL) {
+			if (controls) {
+				lilv_instance_connect_port(instance, p, &port->control);
+			}
+		} else if (port->evbuf) {
+			lilv_instance_connect_port(instance, p,
+			                           lv2_evbuf_get_buffer(port->evbuf));
+		} else if (port->buffer) {
+			lilv_instance_connect_port(instance, p, port->buffer);
+		}
+	}
+}
+
+/**
+   Run the new instance of a crossfade and mix its output into the cycle.
+
+   The new instance reads the same inputs as the running one, but writes to
+   its own outputs, which are faded in linearly over the crossfade length.
+   When the fade is finished, the new instance replaces the running one.
+*/
+static void
+jalv_run_crossfade(Jalv* jalv, uint32_t nframes)
+{
+	JalvCrossfade* const         xfade    = &jalv->crossfade;
+	const JalvProcessPlan* const plan     = &jalv->plan;
+	LilvInstance* const          instance = xfade->instance;
+
+	if (nframes > xfade->capacity) {
+		/* Buffer size grew since the crossfade was prepared, switch now */
+		xfade->position = xfade->length;
+	} else {
+		jalv_connect_instance(jalv, instance, false);
+		for (uint32_t i = 0; i < plan->n_audio_out; ++i) {
+			lilv_instance_connect_port(instance, plan->audio_out[i],
+			                           xfade->audio + i * xfade->capacity);
+		}
+		for (uint32_t i = 0; i < plan->n_event_out; ++i) {
+			lv2_evbuf_reset(xfade->events[i], false);
+			lilv_instance_connect_port(instance, plan->event_out[i],
+			                           lv2_evbuf_get_buffer(xfade->events[i]));
+		}
+
+		lilv_instance_run(instance, nframes);
+
+		/* Fade from the running instance's output to the new instance's */
+		for (uint32_t i = 0; i < plan->n_audio_out; ++i) {
+			struct Port* const port = &jalv->ports[plan->audio_out[i]];
+			float* const       out  = (float*)port->buffer;
+			const float* const in   = xfade->audio + i * xfade->capacity;
+			for (uint32_t f = 0; out && f < nframes; ++f) {
+				const uint32_t t = xfade->position + f;
+				const float    g = (t < xfade->length)
+					? (float)t / (float)xfade->length : 1.0f;
+				out[f] += g * (in[f] - out[f]);
+			}
+		}
+		xfade->position += nframes;
+	}
+
+	if (xfade->position >= xfade->length) {
+		/* Take the new control values and swap in the new instance */
+		for (uint32_t p = 0; p < jalv->num_ports; ++p) {
+			struct Port* const port = &jalv->ports[p];
+			if (port->type == TYPE_CONTROL && port->flow == FLOW_INPUT) {
+				port->control = xfade->controls[p];
+			}
+		}
+		jalv_connect_instance(jalv, instance, true);
+
+		xfade->instance = jalv->instance;
+		jalv->instance  = instance;
+		zix_atomic_store(&xfade->state, JALV_FADE_DONE);
+	}
+}
+
 bool
 jalv_run(Jalv* jalv, uint32_t nframes)
 {
-	/* Read and apply control change events from UI */
-	jalv_apply_ui_events(jalv, nframes);
+	/* Classify work scheduled in this cycle, events from the UI may raise it */
+	if (zix_atomic_load(&jalv->restored)) {
+		zix_atomic_store(&jalv->restored, 0);
+		jalv->worker.priority = JALV_WORK_RESTORE;
+	} else {
+		jalv->worker.priority = JALV_WORK_BACKGROUND;
+	}
 
-	/* Run plugin for this cycle */
-	lilv_instance_run(jalv->instance, nframes);
+	if (jalv->opts.min_slice) {
+		/* Run plugin for this cycle with sample-accurate control changes */
+		jalv_run_split(jalv, nframes);
+	} else {
+		/* Read and apply control change events from UI */
+		jalv_apply_ui_events(jalv, nframes);
+
+		/* Run plugin for this cycle */
+		lilv_instance_run(jalv->instance, nframes);
+	}
 
 	/* Process any worker replies. */
 	jalv_worker_emit_responses(&jalv->state_worker, jalv->instance);
@@ -623,6 +1153,19 @@ jalv_run(Jalv* jalv, uint32_t nframes)
 		jalv->worker.iface->end_run(jalv->instance->lv2_handle);
 	}
 
+	/* Fade to a new instance with restored state if one is ready, and the
+	   fade is not being cancelled */
+	JalvCrossfade* const xfade = &jalv->crossfade;
+	if (zix_atomic_load(&xfade->state) == JALV_FADE_READY) {
+		if (!zix_atomic_add(&xfade->lock, 1) &&
+		    zix_atomic_load(&xfade->state) == JALV_FADE_READY) {
+			jalv_run_crossfade(jalv, nframes);
+		}
+		zix_atomic_sub(&xfade->lock, 1);
+	}
+
+	jalv->frame_time += nframes;
+
 	/* Check if it's time to send updates to the UI */
 	jalv->event_delta_t += nframes;
 	bool  send_ui_updates = false;
@@ -630,6 +1173,12 @@ jalv_run(Jalv* jalv, uint32_t nframes)
 	if (jalv->has_ui && (jalv->event_delta_t > update_frames)) {
 		send_ui_updates = true;
 		jalv->event_delta_t = 0;
+
+		const JalvProcessPlan* const plan = &jalv->plan;
+		for (uint32_t i = 0; i < plan->n_control_out; ++i) {
+			struct Port* const port = &jalv->ports[plan->control_out[i]];
+			jalv_publish_control(jalv, port, port->control);
+		}
 	}
 
 	return send_ui_updates;
@@ -644,40 +1193,77 @@ jalv_update(Jalv* jalv)
 		return false;
 	}
 
-	/* Emit UI events. */
-	ControlChange ev;
-	const size_t  space = zix_ring_read_space(jalv->plugin_events);
-	for (size_t i = 0;
-	     i + sizeof(ev) < space;
-	     i += sizeof(ev) + ev.size) {
-		/* Read event header to get the size */
-		zix_ring_read(jalv->plugin_events, (char*)&ev, sizeof(ev));
+	/* Report events dropped by the process thread since the last update */
+	const uint32_t n_drops = zix_atomic_load(&jalv->n_plugin_drops);
+	if (n_drops != jalv->drops_reported) {
+		fprintf(stderr, "warning: Plugin => UI buffer overflow, "
+		        "dropped %u events\n", n_drops - jalv->drops_reported);
+		jalv->drops_reported = n_drops;
+	}
+
+	/* Emit changed control values */
+	if (zix_atomic_load(&jalv->controls_dirty)) {
+		zix_atomic_store(&jalv->controls_dirty, 0);
+		for (uint32_t i = 0; i < jalv->num_ports; ++i) {
+			struct Port* const port = &jalv->ports[i];
+			if (port->type == TYPE_CONTROL &&
+			    zix_atomic_load(&port->ui_dirty)) {
+				zix_atomic_store(&port->ui_dirty, 0);
+
+				const uint32_t bits  = zix_atomic_load(&port->ui_value);
+				float          value = 0.0f;
+				memcpy(&value, &bits, sizeof(value));
+
+				jalv_ui_port_event(jalv, i, sizeof(float), 0, &value);
+				if (jalv->opts.print_controls) {
+					jalv_print_control(jalv, port, value);
+				}
+			}
+		}
+	}
+
+	/* Read events in place in the ring, or copy them to a contiguous buffer
+	   if they wrap around the end */
+	ZixRingVector  vec;
+	const uint32_t space = zix_ring_peek_vector(jalv->plugin_events, &vec);
+	const uint8_t* buf   = (const uint8_t*)vec.data[0];
+	if (vec.size[1]) {
+		if (space > jalv->ui_event_cap) {
+			jalv->ui_event_buf = realloc(jalv->ui_event_buf, space);
+			jalv->ui_event_cap = space;
+		}
 
-		/* Resize read buffer if necessary */
-		jalv->ui_event_buf = realloc(jalv->ui_event_buf, ev.size);
-		void* const buf = jalv->ui_event_buf;
+		memcpy(jalv->ui_event_buf, vec.data[0], vec.size[0]);
+		memcpy((uint8_t*)jalv->ui_event_buf + vec.size[0],
+		       vec.data[1], vec.size[1]);
+		buf = (const uint8_t*)jalv->ui_event_buf;
+	}
 
-		/* Read event body */
-		zix_ring_read(jalv->plugin_events, (char*)buf, ev.size);
+	/* Emit UI events */
+	uint32_t offset = 0;
+	while (offset + sizeof(ControlChange) <= space) {
+		const ControlChange* const ev = (const ControlChange*)(buf + offset);
+		if (offset + sizeof(ControlChange) + ev->size > space) {
+			break;  // Truncated event, should not happen
+		}
 
-		if (jalv->opts.dump && ev.protocol == jalv->urids.atom_eventTransfer) {
+		if (jalv->opts.dump && ev->protocol == jalv->urids.atom_eventTransfer) {
 			/* Dump event in Turtle to the console */
-			LV2_Atom* atom = (LV2_Atom*)buf;
-			char*     str  = sratom_to_turtle(
+			const LV2_Atom* atom = (const LV2_Atom*)ev->body;
+			char*           str  = sratom_to_turtle(
 				jalv->ui_sratom, &jalv->unmap, "jalv:", NULL, NULL,
-				atom->type, atom->size, LV2_ATOM_BODY(atom));
+				atom->type, atom->size, LV2_ATOM_BODY_CONST(atom));
 			jalv_ansi_start(stdout, 35);
 			printf("\n## Plugin => UI (%u bytes) ##\n%s\n", atom->size, str);
 			jalv_ansi_reset(stdout);
 			free(str);
 		}
 
-		jalv_ui_port_event(jalv, ev.index, ev.size, ev.protocol, buf);
+		jalv_ui_port_event(jalv, ev->index, ev->size, ev->protocol, ev->body);
 
-		if (ev.protocol == 0 && jalv->opts.print_controls) {
-			jalv_print_control(jalv, &jalv->ports[ev.index], *(float*)buf);
-		}
+		offset += sizeof(ControlChange) + ev->size;
 	}
+	zix_ring_skip(jalv->plugin_events, offset);
 
 	return true;
 }
@@ -685,9 +1271,10 @@ jalv_update(Jalv* jalv)
 static bool
 jalv_apply_control_arg(Jalv* jalv, const char* s)
 {
-	char  sym[256];
-	float val = 0.0f;
-	if (sscanf(s, "%[^=]=%f", sym, &val) != 2) {
+	char     sym[256];
+	float    val  = 0.0f;
+	uint64_t time = 0;
+	if (sscanf(s, "%[^=]=%f@%" SCNu64, sym, &val, &time) < 2) {
 		fprintf(stderr, "warning: Ignoring invalid value `%s'\n", s);
 		return false;
 	}
@@ -698,8 +1285,13 @@ jalv_apply_control_arg(Jalv* jalv, const char* s)
 		return false;
 	}
 
-	jalv_set_control(control, sizeof(float), jalv->urids.atom_Float, &val);
-	printf("%s = %f\n", sym, val);
+	jalv_set_control_at(control, time, sizeof(float), jalv->urids.atom_Float,
+	                    &val);
+	if (time) {
+		printf("%s = %f at %" PRIu64 "\n", sym, val, time);
+	} else {
+		printf("%s = %f\n", sym, val);
+	}
 
 	return true;
 }
@@ -736,49 +1328,362 @@ setup_signals(Jalv* const jalv)
 #endif
 }
 
-int
-jalv_open(Jalv* const jalv, int argc, char** argv)
-{
-	jalv->prog_name     = argv[0];
-	jalv->block_length  = 4096;  /* Should be set by backend */
-	jalv->midi_buf_size = 1024;  /* Should be set by backend */
-	jalv->play_state    = JALV_PAUSED;
-	jalv->bpm           = 120.0f;
-	jalv->control_in    = (uint32_t)-1;
-
-#ifdef HAVE_SUIL
-	suil_init(&argc, &argv, SUIL_ARG_NONE);
-#endif
-
-	if (jalv_init(&argc, &argv, &jalv->opts)) {
-		jalv_close(jalv);
-		return -1;
-	}
-
-	if (jalv->opts.uuid) {
-		printf("UUID: %s\n", jalv->opts.uuid);
-	}
+/**
+   Set up the features and synchronisation primitives of an instance.
 
-	jalv->symap = symap_new();
-	zix_sem_init(&jalv->symap_lock, 1);
+   These are specific to each plugin instance, unlike the world and URI map
+   which are shared by all instances hosted in this process.
+*/
+static void
+jalv_init_features(Jalv* const jalv)
+{
 	zix_sem_init(&jalv->work_lock, 1);
-
-	jalv->map.handle  = jalv;
-	jalv->map.map     = map_uri;
-	init_feature(&jalv->features.map_feature, LV2_URID__map, &jalv->map);
+	zix_sem_init(&jalv->paused, 0);
 
 	jalv->worker.jalv       = jalv;
 	jalv->state_worker.jalv = jalv;
 
-	jalv->unmap.handle  = jalv;
-	jalv->unmap.unmap   = unmap_uri;
-	init_feature(&jalv->features.unmap_feature, LV2_URID__unmap, &jalv->unmap);
-
-	lv2_atom_forge_init(&jalv->forge, &jalv->map);
-
-	jalv->env = serd_env_new(NULL);
-	serd_env_set_prefix_from_strings(
-		jalv->env, (const uint8_t*)"patch", (const uint8_t*)LV2_PATCH_PREFIX);
+#ifdef _WIN32
+	jalv->temp_dir = jalv_strdup("jalvXXXXXX");
+	_mktemp(jalv->temp_dir);
+#else
+	char* templ = jalv_strdup("/tmp/jalv-XXXXXX");
+	jalv->temp_dir = jalv_strjoin(mkdtemp(templ), "/");
+	free(templ);
+#endif
+
+	jalv->features.make_path.handle = jalv;
+	jalv->features.make_path.path = jalv_make_path;
+	init_feature(&jalv->features.make_path_feature,
+	             LV2_STATE__makePath, &jalv->features.make_path);
+
+	jalv->features.sched.handle = &jalv->worker;
+	jalv->features.sched.schedule_work = jalv_worker_schedule;
+	init_feature(&jalv->features.sched_feature,
+	             LV2_WORKER__schedule, &jalv->features.sched);
+
+	jalv->features.ssched.handle = &jalv->state_worker;
+	jalv->features.ssched.schedule_work = jalv_worker_schedule;
+	init_feature(&jalv->features.state_sched_feature,
+	             LV2_WORKER__schedule, &jalv->features.ssched);
+
+	jalv->features.llog.handle  = jalv;
+	jalv->features.llog.printf  = jalv_printf;
+	jalv->features.llog.vprintf = jalv_vprintf;
+	init_feature(&jalv->features.log_feature,
+	             LV2_LOG__log, &jalv->features.llog);
+}
+
+/**
+   Create port and control structures, from the port cache if possible.
+
+   If the cache is missing or stale, they are created from the plugin data,
+   and the cache is saved for next time.
+*/
+static void
+jalv_init_ports(Jalv* const jalv)
+{
+	if (!jalv_load_port_cache(jalv)) {
+		jalv_phase(jalv, "port_cache_load");
+	} else {
+		jalv_create_ports(jalv);
+		jalv_phase(jalv, "port_creation");
+		jalv_create_controls(jalv, true);
+		jalv_create_controls(jalv, false);
+		jalv_phase(jalv, "control_creation");
+		jalv_save_port_cache(jalv);
+		jalv_phase(jalv, "port_cache_save");
+	}
+}
+
+/**
+   Instantiate the plugin, apply the initial state, and activate it.
+
+   The audio engine properties (sample rate, block length, etc.) must already
+   be known, and ports must be created.
+*/
+static int
+jalv_instantiate(Jalv* const jalv, LilvState* state)
+{
+	/* Split runs (with -S) may be as short as a single frame */
+	static const int32_t min_split_length = 1;
+	const void* const    min_length       = jalv->opts.min_slice
+		? (const void*)&min_split_length
+		: (const void*)&jalv->block_length;
+
+	/* Build options array to pass to plugin */
+	const LV2_Options_Option options[ARRAY_SIZE(jalv->features.options)] = {
+		{ LV2_OPTIONS_INSTANCE, 0, jalv->urids.param_sampleRate,
+		  sizeof(float), jalv->urids.atom_Float, &jalv->sample_rate },
+		{ LV2_OPTIONS_INSTANCE, 0, jalv->urids.bufsz_minBlockLength,
+		  sizeof(int32_t), jalv->urids.atom_Int, min_length },
+		{ LV2_OPTIONS_INSTANCE, 0, jalv->urids.bufsz_maxBlockLength,
+		  sizeof(int32_t), jalv->urids.atom_Int, &jalv->block_length },
+		{ LV2_OPTIONS_INSTANCE, 0, jalv->urids.bufsz_sequenceSize,
+		  sizeof(int32_t), jalv->urids.atom_Int, &jalv->midi_buf_size },
+		{ LV2_OPTIONS_INSTANCE, 0, jalv->urids.ui_updateRate,
+		  sizeof(float), jalv->urids.atom_Float, &jalv->ui_update_hz },
+		{ LV2_OPTIONS_INSTANCE, 0, 0, 0, 0, NULL }
+	};
+	memcpy(jalv->features.options, options, sizeof(jalv->features.options));
+
+	init_feature(&jalv->features.options_feature,
+	             LV2_OPTIONS__options,
+	             (void*)jalv->features.options);
+
+	init_feature(&jalv->features.safe_restore_feature,
+	             LV2_STATE__threadSafeRestore,
+	             NULL);
+
+	/* Create Plugin <=> UI communication buffers */
+	jalv->ui_events     = zix_ring_new(jalv->opts.buffer_size);
+	jalv->plugin_events = zix_ring_new(jalv->opts.buffer_size);
+	zix_ring_mlock(jalv->ui_events);
+	zix_ring_mlock(jalv->plugin_events);
+
+	/* Allocate queue for scheduled UI events, large enough for any one, and
+	   scratch space of the same size after it for reading from the ring */
+	jalv->ui_pending_cap = lv2_atom_pad_size(
+		zix_ring_capacity(jalv->ui_events) + sizeof(ControlChange));
+	jalv->ui_pending     = (uint8_t*)malloc(2 * (size_t)jalv->ui_pending_cap);
+
+	/* Build feature list for passing to plugins.  Split runs have arbitrary
+	   lengths, so fixed or power of 2 block lengths are only promised if runs
+	   are not split. */
+	const bool whole = !jalv->opts.min_slice;
+
+	const LV2_Feature* const features[] = {
+		&jalv->features.map_feature,
+		&jalv->features.unmap_feature,
+		&jalv->features.sched_feature,
+		&jalv->features.log_feature,
+		&jalv->features.options_feature,
+		&static_features[0],
+		&static_features[3],
+		whole ? &static_features[1] : NULL,
+		whole ? &static_features[2] : NULL,
+		NULL
+	};
+	jalv->feature_list = calloc(1, sizeof(features));
+	if (!jalv->feature_list) {
+		fprintf(stderr, "Failed to allocate feature list\n");
+		return -7;
+	}
+	memcpy(jalv->feature_list, features, sizeof(features));
+
+	/* Check that any required features are supported */
+	LilvNodes* req_feats = lilv_plugin_get_required_features(jalv->plugin);
+	LILV_FOREACH(nodes, f, req_feats) {
+		const char* uri = lilv_node_as_uri(lilv_nodes_get(req_feats, f));
+		if (!feature_is_supported(jalv, uri)) {
+			if (jalv->opts.min_slice &&
+			    (!strcmp(uri, LV2_BUF_SIZE__powerOf2BlockLength) ||
+			     !strcmp(uri, LV2_BUF_SIZE__fixedBlockLength))) {
+				fprintf(stderr, "Feature %s is not supported with -S\n", uri);
+			} else {
+				fprintf(stderr, "Feature %s is not supported\n", uri);
+			}
+			lilv_nodes_free(req_feats);
+			return -8;
+		}
+	}
+	lilv_nodes_free(req_feats);
+
+	/* Instantiate the plugin */
+	jalv->instance = lilv_plugin_instantiate(
+		jalv->plugin, jalv->sample_rate, jalv->feature_list);
+	if (!jalv->instance) {
+		fprintf(stderr, "Failed to instantiate plugin.\n");
+		return -9;
+	}
+
+	jalv->features.ext_data.data_access =
+		lilv_instance_get_descriptor(jalv->instance)->extension_data;
+	jalv_phase(jalv, "instantiation");
+
+	fprintf(stderr, "\n");
+	if (!jalv->buf_size_set) {
+		jalv_allocate_port_buffers(jalv);
+		jalv_phase(jalv, "buffer_allocation");
+	}
+
+	/* Create workers if necessary */
+	if (lilv_plugin_has_extension_data(jalv->plugin, jalv->nodes.work_interface)) {
+		const LV2_Worker_Interface* iface = (const LV2_Worker_Interface*)
+			lilv_instance_get_extension_data(jalv->instance, LV2_WORKER__interface);
+
+		jalv_worker_init(jalv, &jalv->worker, iface, true);
+		if (jalv->safe_restore) {
+			jalv_worker_init(jalv, &jalv->state_worker, iface, false);
+		}
+	}
+
+	/* Apply loaded state to plugin instance if necessary */
+	if (state) {
+		jalv_apply_state(jalv, state);
+	}
+
+	if (jalv->opts.controls) {
+		for (char** c = jalv->opts.controls; *c; ++c) {
+			jalv_apply_control_arg(jalv, *c);
+		}
+	}
+	jalv_phase(jalv, "state_apply");
+
+	/* Create Jack ports and connect plugin ports to buffers */
+	for (uint32_t i = 0; i < jalv->num_ports; ++i) {
+		jalv_backend_activate_port(jalv, i);
+	}
+	jalv_build_process_plan(jalv);
+
+	/* Print initial control values */
+	for (size_t i = 0; i < jalv->controls.n_controls; ++i) {
+		ControlID* control = jalv->controls.controls[i];
+		if (control->type == PORT && control->is_writable) {
+			struct Port* port = &jalv->ports[control->index];
+			jalv_print_control(jalv, port, port->control);
+		}
+	}
+
+	jalv_phase(jalv, "port_activation");
+
+	/* Activate plugin */
+	lilv_instance_activate(jalv->instance);
+	jalv_phase(jalv, "plugin_activation");
+	return 0;
+}
+
+/**
+   Open an additional instance of a plugin in the same process.
+
+   The new instance shares the world, URI map, and audio backend of the host,
+   and is run by the backend in the same cycle after the host instance.
+*/
+static int
+jalv_open_instance(Jalv* const host, const char* const uri)
+{
+	Jalv* const jalv = (Jalv*)calloc(1, sizeof(Jalv));
+
+	/* Share everything loaded once per process with the host */
+	jalv->opts           = host->opts;
+	jalv->opts.load      = NULL;
+	jalv->opts.preset    = NULL;
+	jalv->opts.controls  = NULL;
+	jalv->opts.instances = NULL;
+	jalv->phase_start    = jalv_timestamp();
+	jalv->urids          = host->urids;
+	jalv->nodes          = host->nodes;
+	jalv->forge          = host->forge;
+	jalv->prog_name      = host->prog_name;
+	jalv->world          = host->world;
+	jalv->map            = host->map;
+	jalv->unmap          = host->unmap;
+	jalv->env            = host->env;
+	jalv->symap          = host->symap;
+	jalv->backend        = host->backend;
+	jalv->worker_pool    = host->worker_pool;
+	jalv->host           = host;
+	jalv->instance_index = host->n_instances + 1;
+	jalv->play_state     = JALV_PAUSED;
+	jalv->bpm            = host->bpm;
+	jalv->control_in     = (uint32_t)-1;
+	jalv->sample_rate    = host->sample_rate;
+	jalv->block_length   = host->block_length;
+	jalv->midi_buf_size  = host->midi_buf_size;
+	jalv->ui_update_hz   = host->ui_update_hz;
+
+	init_feature(&jalv->features.map_feature, LV2_URID__map, &jalv->map);
+	init_feature(&jalv->features.unmap_feature, LV2_URID__unmap, &jalv->unmap);
+	jalv_init_features(jalv);
+
+	jalv->sratom    = sratom_new(&jalv->map);
+	jalv->ui_sratom = sratom_new(&jalv->map);
+	sratom_set_env(jalv->sratom, jalv->env);
+	sratom_set_env(jalv->ui_sratom, jalv->env);
+
+	host->instances = (Jalv**)realloc(
+		host->instances, (host->n_instances + 1) * sizeof(Jalv*));
+	host->instances[host->n_instances++] = jalv;
+
+	/* Find plugin */
+	LilvNode* plugin_uri = lilv_new_uri(jalv->world, uri);
+	printf("Instance %u:   %s\n", jalv->instance_index, uri);
+	jalv->plugin = lilv_plugins_get_by_uri(
+		lilv_world_get_all_plugins(jalv->world), plugin_uri);
+	lilv_node_free(plugin_uri);
+	if (!jalv->plugin) {
+		fprintf(stderr, "Failed to find plugin\n");
+		return -4;
+	}
+	jalv_phase(jalv, "plugin_lookup");
+
+	/* Check for thread-safe state restore() method. */
+	LilvNode* state_threadSafeRestore = lilv_new_uri(
+		jalv->world, LV2_STATE__threadSafeRestore);
+	if (lilv_plugin_has_feature(jalv->plugin, state_threadSafeRestore)) {
+		jalv->safe_restore = true;
+	}
+	lilv_node_free(state_threadSafeRestore);
+
+	jalv_init_ports(jalv);
+
+	/* Instantiate with default state and activate */
+	LilvState* state = lilv_state_new_from_world(
+		jalv->world, &jalv->map, lilv_plugin_get_uri(jalv->plugin));
+	jalv_phase(jalv, "state_load");
+	const int st = jalv_instantiate(jalv, state);
+	lilv_state_free(state);
+	if (!st) {
+		jalv->play_state = JALV_RUNNING;
+	}
+
+	return st;
+}
+
+int
+jalv_open(Jalv* const jalv, int argc, char** argv)
+{
+	const JalvTimestamp start = jalv_timestamp();
+	int                 st    = 0;
+
+	jalv->prog_name     = argv[0];
+	jalv->block_length  = 4096;  /* Should be set by backend */
+	jalv->midi_buf_size = 1024;  /* Should be set by backend */
+	jalv->play_state    = JALV_PAUSED;
+	jalv->bpm           = 120.0f;
+	jalv->control_in    = (uint32_t)-1;
+
+#ifdef HAVE_SUIL
+	suil_init(&argc, &argv, SUIL_ARG_NONE);
+#endif
+
+	if (jalv_init(&argc, &argv, &jalv->opts)) {
+		jalv_close(jalv);
+		return -1;
+	}
+
+	jalv->phase_start = start;
+	if (jalv->opts.uuid) {
+		printf("UUID: %s\n", jalv->opts.uuid);
+	}
+
+	jalv->symap = symap_new();
+	zix_sem_init(&jalv->symap_lock, 1);
+	jalv_log_init(jalv);
+
+	jalv->map.handle  = jalv;
+	jalv->map.map     = map_uri;
+	init_feature(&jalv->features.map_feature, LV2_URID__map, &jalv->map);
+
+	jalv->unmap.handle  = jalv;
+	jalv->unmap.unmap   = unmap_uri;
+	init_feature(&jalv->features.unmap_feature, LV2_URID__unmap, &jalv->unmap);
+
+	lv2_atom_forge_init(&jalv->forge, &jalv->map);
+
+	jalv->env = serd_env_new(NULL);
+	serd_env_set_prefix_from_strings(
+		jalv->env, (const uint8_t*)"patch", (const uint8_t*)LV2_PATCH_PREFIX);
 	serd_env_set_prefix_from_strings(
 		jalv->env, (const uint8_t*)"time", (const uint8_t*)LV2_TIME_PREFIX);
 	serd_env_set_prefix_from_strings(
@@ -819,46 +1724,11 @@ jalv_open(Jalv* const jalv, int argc, char** argv)
 	jalv->urids.time_speed           = symap_map(jalv->symap, LV2_TIME__speed);
 	jalv->urids.ui_updateRate        = symap_map(jalv->symap, LV2_UI__updateRate);
 
-#ifdef _WIN32
-	jalv->temp_dir = jalv_strdup("jalvXXXXXX");
-	_mktemp(jalv->temp_dir);
-#else
-	char* templ = jalv_strdup("/tmp/jalv-XXXXXX");
-	jalv->temp_dir = jalv_strjoin(mkdtemp(templ), "/");
-	free(templ);
-#endif
-
-	jalv->features.make_path.handle = jalv;
-	jalv->features.make_path.path = jalv_make_path;
-	init_feature(&jalv->features.make_path_feature,
-	             LV2_STATE__makePath, &jalv->features.make_path);
-
-	jalv->features.sched.handle = &jalv->worker;
-	jalv->features.sched.schedule_work = jalv_worker_schedule;
-	init_feature(&jalv->features.sched_feature,
-	             LV2_WORKER__schedule, &jalv->features.sched);
-
-	jalv->features.ssched.handle = &jalv->state_worker;
-	jalv->features.ssched.schedule_work = jalv_worker_schedule;
-	init_feature(&jalv->features.state_sched_feature,
-	             LV2_WORKER__schedule, &jalv->features.ssched);
-
-	jalv->features.llog.handle  = jalv;
-	jalv->features.llog.printf  = jalv_printf;
-	jalv->features.llog.vprintf = jalv_vprintf;
-	init_feature(&jalv->features.log_feature,
-	             LV2_LOG__log, &jalv->features.llog);
-
+	jalv_init_features(jalv);
 	zix_sem_init(&jalv->done, 0);
 
-	zix_sem_init(&jalv->paused, 0);
-	zix_sem_init(&jalv->worker.sem, 0);
-
-	/* Find all installed plugins */
 	LilvWorld* world = lilv_world_new();
-	lilv_world_load_all(world);
 	jalv->world = world;
-	const LilvPlugins* plugins = lilv_world_get_all_plugins(world);
 
 	/* Cache URIs for concepts we'll use */
 	jalv->nodes.atom_AtomPort          = lilv_new_uri(world, LV2_ATOM__AtomPort);
@@ -866,6 +1736,7 @@ jalv_open(Jalv* const jalv, int argc, char** argv)
 	jalv->nodes.atom_Float             = lilv_new_uri(world, LV2_ATOM__Float);
 	jalv->nodes.atom_Path              = lilv_new_uri(world, LV2_ATOM__Path);
 	jalv->nodes.atom_Sequence          = lilv_new_uri(world, LV2_ATOM__Sequence);
+	jalv->nodes.jalv_threadSafeWork    = lilv_new_uri(world, NS_JALV "threadSafeWork");
 	jalv->nodes.lv2_AudioPort          = lilv_new_uri(world, LV2_CORE__AudioPort);
 	jalv->nodes.lv2_CVPort             = lilv_new_uri(world, LV2_CORE__CVPort);
 	jalv->nodes.lv2_ControlPort        = lilv_new_uri(world, LV2_CORE__ControlPort);
@@ -897,6 +1768,7 @@ jalv_open(Jalv* const jalv, int argc, char** argv)
 	jalv->nodes.work_interface         = lilv_new_uri(world, LV2_WORKER__interface);
 	jalv->nodes.work_schedule          = lilv_new_uri(world, LV2_WORKER__schedule);
 	jalv->nodes.end                    = NULL;
+	jalv_phase(jalv, "setup");
 
 	/* Get plugin URI from loaded state or command line */
 	LilvState* state      = NULL;
@@ -918,6 +1790,7 @@ jalv_open(Jalv* const jalv, int argc, char** argv)
 			return -2;
 		}
 		plugin_uri = lilv_node_duplicate(lilv_state_get_plugin_uri(state));
+		jalv_phase(jalv, "state_load");
 	} else if (argc > 1) {
 		plugin_uri = lilv_new_uri(world, argv[argc - 1]);
 	}
@@ -928,22 +1801,44 @@ jalv_open(Jalv* const jalv, int argc, char** argv)
 		return -3;
 	}
 
+	/* Load only the plugin's bundles if indexed, otherwise all of them */
+	const char* uri     = lilv_node_as_uri(plugin_uri);
+	bool        indexed = !jalv_load_indexed_bundles(jalv, uri);
+	if (!indexed) {
+		lilv_world_load_all(world);
+	}
+	jalv_phase(jalv, "world_load");
+
 	/* Find plugin */
-	printf("Plugin:       %s\n", lilv_node_as_string(plugin_uri));
+	printf("Plugin:       %s\n", uri);
+	const LilvPlugins* plugins = lilv_world_get_all_plugins(world);
 	jalv->plugin = lilv_plugins_get_by_uri(plugins, plugin_uri);
+	if (!jalv->plugin && indexed) {
+		/* Bundle index is out of date, fall back to loading everything */
+		lilv_world_load_all(world);
+		jalv->plugin = lilv_plugins_get_by_uri(plugins, plugin_uri);
+		indexed      = false;
+	} else if (jalv->plugin && indexed &&
+	           jalv_check_indexed_bundles(jalv, uri)) {
+		/* Properties are defined elsewhere, load everything but keep index */
+		lilv_world_load_all(world);
+	}
+	if (jalv->plugin && !indexed) {
+		jalv_index_bundles(jalv, uri);
+	}
 	lilv_node_free(plugin_uri);
 	if (!jalv->plugin) {
 		fprintf(stderr, "Failed to find plugin\n");
 		jalv_close(jalv);
 		return -4;
 	}
+	jalv_phase(jalv, "plugin_lookup");
 
 	/* Load preset, if specified */
 	if (jalv->opts.preset) {
 		LilvNode* preset = lilv_new_uri(jalv->world, jalv->opts.preset);
 
-		jalv_load_presets(jalv, NULL, NULL);
-		state = lilv_state_new_from_world(jalv->world, &jalv->map, preset);
+		state = jalv_load_preset(jalv, preset);
 		jalv->preset = state;
 		lilv_node_free(preset);
 		if (!state) {
@@ -966,6 +1861,7 @@ jalv_open(Jalv* const jalv, int argc, char** argv)
 		state = lilv_state_new_from_world(
 			jalv->world, &jalv->map, lilv_plugin_get_uri(jalv->plugin));
 	}
+	jalv_phase(jalv, "preset_load");
 
 	/* Get a plugin UI */
 	const char* native_ui_type_uri = jalv_native_ui_type();
@@ -996,17 +1892,16 @@ jalv_open(Jalv* const jalv, int argc, char** argv)
 	} else {
 		fprintf(stderr, "UI:           None\n");
 	}
+	jalv_phase(jalv, "ui_lookup");
 
-	/* Create port and control structures */
-	jalv_create_ports(jalv);
-	jalv_create_controls(jalv, true);
-	jalv_create_controls(jalv, false);
+	jalv_init_ports(jalv);
 
 	if (!(jalv->backend = jalv_backend_init(jalv))) {
 		fprintf(stderr, "Failed to connect to audio system\n");
 		jalv_close(jalv);
 		return -6;
 	}
+	jalv_phase(jalv, "backend_init");
 
 	printf("Sample rate:  %u Hz\n", (uint32_t)jalv->sample_rate);
 	printf("Block length: %u frames\n", jalv->block_length);
@@ -1038,133 +1933,98 @@ jalv_open(Jalv* const jalv, int argc, char** argv)
 	fprintf(stderr, "Comm buffers: %d bytes\n", jalv->opts.buffer_size);
 	fprintf(stderr, "Update rate:  %.01f Hz\n", jalv->ui_update_hz);
 
-	/* Build options array to pass to plugin */
-	const LV2_Options_Option options[ARRAY_SIZE(jalv->features.options)] = {
-		{ LV2_OPTIONS_INSTANCE, 0, jalv->urids.param_sampleRate,
-		  sizeof(float), jalv->urids.atom_Float, &jalv->sample_rate },
-		{ LV2_OPTIONS_INSTANCE, 0, jalv->urids.bufsz_minBlockLength,
-		  sizeof(int32_t), jalv->urids.atom_Int, &jalv->block_length },
-		{ LV2_OPTIONS_INSTANCE, 0, jalv->urids.bufsz_maxBlockLength,
-		  sizeof(int32_t), jalv->urids.atom_Int, &jalv->block_length },
-		{ LV2_OPTIONS_INSTANCE, 0, jalv->urids.bufsz_sequenceSize,
-		  sizeof(int32_t), jalv->urids.atom_Int, &jalv->midi_buf_size },
-		{ LV2_OPTIONS_INSTANCE, 0, jalv->urids.ui_updateRate,
-		  sizeof(float), jalv->urids.atom_Float, &jalv->ui_update_hz },
-		{ LV2_OPTIONS_INSTANCE, 0, 0, 0, 0, NULL }
-	};
-	memcpy(jalv->features.options, options, sizeof(jalv->features.options));
-
-	init_feature(&jalv->features.options_feature,
-	             LV2_OPTIONS__options,
-	             (void*)jalv->features.options);
-
-	init_feature(&jalv->features.safe_restore_feature,
-	             LV2_STATE__threadSafeRestore,
-	             NULL);
-
-	/* Create Plugin <=> UI communication buffers */
-	jalv->ui_events     = zix_ring_new(jalv->opts.buffer_size);
-	jalv->plugin_events = zix_ring_new(jalv->opts.buffer_size);
-	zix_ring_mlock(jalv->ui_events);
-	zix_ring_mlock(jalv->plugin_events);
+	/* Start worker threads shared by every instance */
+	uint32_t n_instances = 0;
+	for (char** i = jalv->opts.instances; i && *i; ++i) {
+		++n_instances;
+	}
+	jalv->opts.worker_threads = MAX(1, jalv->opts.worker_threads);
+	jalv->worker_pool         = jalv_worker_pool_new(jalv->opts.worker_threads,
+	                                                 n_instances + 1);
+	fprintf(stderr, "Work threads: %u\n", jalv->opts.worker_threads);
+	jalv_phase(jalv, "worker_threads");
 
-	/* Build feature list for passing to plugins */
-	const LV2_Feature* const features[] = {
-		&jalv->features.map_feature,
-		&jalv->features.unmap_feature,
-		&jalv->features.sched_feature,
-		&jalv->features.log_feature,
-		&jalv->features.options_feature,
-		&static_features[0],
-		&static_features[1],
-		&static_features[2],
-		&static_features[3],
-		NULL
-	};
-	jalv->feature_list = calloc(1, sizeof(features));
-	if (!jalv->feature_list) {
-		fprintf(stderr, "Failed to allocate feature list\n");
+	if ((st = jalv_instantiate(jalv, state))) {
 		jalv_close(jalv);
-		return -7;
+		return st;
 	}
-	memcpy(jalv->feature_list, features, sizeof(features));
 
-	/* Check that any required features are supported */
-	LilvNodes* req_feats = lilv_plugin_get_required_features(jalv->plugin);
-	LILV_FOREACH(nodes, f, req_feats) {
-		const char* uri = lilv_node_as_uri(lilv_nodes_get(req_feats, f));
-		if (!feature_is_supported(jalv, uri)) {
-			fprintf(stderr, "Feature %s is not supported\n", uri);
-			jalv_close(jalv);
-			return -8;
+	/* Open any additional instances hosted in this process */
+	if (jalv->opts.instances) {
+		for (char** i = jalv->opts.instances; *i; ++i) {
+			if ((st = jalv_open_instance(jalv, *i))) {
+				jalv_close(jalv);
+				return st;
+			}
 		}
+		jalv_phase(jalv, "instances");
 	}
-	lilv_nodes_free(req_feats);
-
-	/* Instantiate the plugin */
-	jalv->instance = lilv_plugin_instantiate(
-		jalv->plugin, jalv->sample_rate, jalv->feature_list);
-	if (!jalv->instance) {
-		fprintf(stderr, "Failed to instantiate plugin.\n");
-		jalv_close(jalv);
-		return -9;
-	}
-
-	jalv->features.ext_data.data_access =
-		lilv_instance_get_descriptor(jalv->instance)->extension_data;
 
-	fprintf(stderr, "\n");
-	if (!jalv->buf_size_set) {
-		jalv_allocate_port_buffers(jalv);
-	}
+	/* Discover UI */
+	jalv->has_ui = jalv_discover_ui(jalv);
+	jalv_phase(jalv, "ui_discovery");
 
-	/* Create workers if necessary */
-	if (lilv_plugin_has_extension_data(jalv->plugin, jalv->nodes.work_interface)) {
-		const LV2_Worker_Interface* iface = (const LV2_Worker_Interface*)
-			lilv_instance_get_extension_data(jalv->instance, LV2_WORKER__interface);
+	/* Activate Jack */
+	jalv_backend_activate(jalv);
+	jalv->play_state = JALV_RUNNING;
+	jalv_phase(jalv, "backend_activation");
+	jalv_print_phase(jalv, "total", start);
 
-		jalv_worker_init(jalv, &jalv->worker, iface, true);
-		if (jalv->safe_restore) {
-			jalv_worker_init(jalv, &jalv->state_worker, iface, false);
-		}
-	}
+	return 0;
+}
 
-	/* Apply loaded state to plugin instance if necessary */
-	if (state) {
-		jalv_apply_state(jalv, state);
+static void
+jalv_free_controls(Jalv* const jalv)
+{
+	for (unsigned i = 0; i < jalv->controls.n_controls; ++i) {
+		ControlID* const control = jalv->controls.controls[i];
+		lilv_node_free(control->node);
+		lilv_node_free(control->symbol);
+		lilv_node_free(control->label);
+		lilv_node_free(control->group);
+		lilv_node_free(control->min);
+		lilv_node_free(control->max);
+		lilv_node_free(control->def);
+		free(control);
 	}
+	free(jalv->controls.controls);
+}
 
-	if (jalv->opts.controls) {
-		for (char** c = jalv->opts.controls; *c; ++c) {
-			jalv_apply_control_arg(jalv, *c);
-		}
-	}
+/**
+   Free an additional instance opened with jalv_open_instance().
 
-	/* Create Jack ports and connect plugin ports to buffers */
+   The worker must be finished, and the backend deactivated.
+*/
+static void
+jalv_close_instance(Jalv* const jalv)
+{
 	for (uint32_t i = 0; i < jalv->num_ports; ++i) {
-		jalv_backend_activate_port(jalv, i);
-	}
-
-	/* Print initial control values */
-	for (size_t i = 0; i < jalv->controls.n_controls; ++i) {
-		ControlID* control = jalv->controls.controls[i];
-		if (control->type == PORT && control->is_writable) {
-			struct Port* port = &jalv->ports[control->index];
-			jalv_print_control(jalv, port, port->control);
+		if (jalv->ports[i].evbuf) {
+			lv2_evbuf_free(jalv->ports[i].evbuf);
 		}
+		lv2_evbuf_free(jalv->ports[i].sub_evbuf);
 	}
 
-	/* Activate plugin */
-	lilv_instance_activate(jalv->instance);
-
-	/* Discover UI */
-	jalv->has_ui = jalv_discover_ui(jalv);
+	jalv_worker_destroy(&jalv->worker);
+	if (jalv->instance) {
+		lilv_instance_deactivate(jalv->instance);
+		lilv_instance_free(jalv->instance);
+	}
 
-	/* Activate Jack */
-	jalv_backend_activate(jalv);
-	jalv->play_state = JALV_RUNNING;
+	free(jalv->plan.audio_in);
+	free(jalv->ports);
+	zix_ring_free(jalv->ui_events);
+	zix_ring_free(jalv->plugin_events);
+	jalv_free_controls(jalv);
+	sratom_free(jalv->sratom);
+	sratom_free(jalv->ui_sratom);
 
-	return 0;
+	remove(jalv->temp_dir);
+	free(jalv->temp_dir);
+	free(jalv->ui_event_buf);
+	free(jalv->ui_pending);
+	free(jalv->feature_list);
+	free(jalv);
 }
 
 int
@@ -1174,20 +2034,29 @@ jalv_close(Jalv* const jalv)
 
 	fprintf(stderr, "Exiting...\n");
 
-	/* Terminate the worker */
-	jalv_worker_finish(&jalv->worker);
+	/* Terminate the worker threads */
+	jalv_worker_pool_finish(jalv->worker_pool);
+	for (uint32_t i = 0; i < jalv->n_instances; ++i) {
+		jalv->instances[i]->exit = true;
+	}
 
 	/* Deactivate audio */
 	jalv_backend_deactivate(jalv);
+	for (uint32_t i = 0; i < jalv->n_instances; ++i) {
+		jalv_close_instance(jalv->instances[i]);
+	}
+	free(jalv->instances);
 	for (uint32_t i = 0; i < jalv->num_ports; ++i) {
 		if (jalv->ports[i].evbuf) {
 			lv2_evbuf_free(jalv->ports[i].evbuf);
 		}
+		lv2_evbuf_free(jalv->ports[i].sub_evbuf);
 	}
 	jalv_backend_close(jalv);
 
 	/* Destroy the worker */
 	jalv_worker_destroy(&jalv->worker);
+	jalv_worker_pool_free(jalv->worker_pool);
 
 	/* Deactivate plugin */
 #ifdef HAVE_SUIL
@@ -1198,7 +2067,11 @@ jalv_close(Jalv* const jalv)
 		lilv_instance_free(jalv->instance);
 	}
 
+	/* Print remaining log messages */
+	jalv_log_finish(jalv);
+
 	/* Clean up */
+	free(jalv->plan.audio_in);
 	free(jalv->ports);
 	zix_ring_free(jalv->ui_events);
 	zix_ring_free(jalv->plugin_events);
@@ -1211,18 +2084,7 @@ jalv_close(Jalv* const jalv)
 	suil_host_free(jalv->ui_host);
 #endif
 
-	for (unsigned i = 0; i < jalv->controls.n_controls; ++i) {
-		ControlID* const control = jalv->controls.controls[i];
-		lilv_node_free(control->node);
-		lilv_node_free(control->symbol);
-		lilv_node_free(control->label);
-		lilv_node_free(control->group);
-		lilv_node_free(control->min);
-		lilv_node_free(control->max);
-		lilv_node_free(control->def);
-		free(control);
-	}
-	free(jalv->controls.controls);
+	jalv_free_controls(jalv);
 
 	if (jalv->sratom) {
 		sratom_free(jalv->sratom);
@@ -1231,6 +2093,7 @@ jalv_close(Jalv* const jalv)
 		sratom_free(jalv->ui_sratom);
 	}
 	lilv_uis_free(jalv->uis);
+	jalv_unload_presets(jalv);
 	lilv_world_free(jalv->world);
 
 	zix_sem_destroy(&jalv->done);
@@ -1238,12 +2101,17 @@ jalv_close(Jalv* const jalv)
 	remove(jalv->temp_dir);
 	free(jalv->temp_dir);
 	free(jalv->ui_event_buf);
+	free(jalv->ui_pending);
 	free(jalv->feature_list);
 
 	free(jalv->opts.name);
 	free(jalv->opts.uuid);
 	free(jalv->opts.load);
 	free(jalv->opts.controls);
+	free(jalv->opts.instances);
+	free(jalv->opts.audio_in);
+	free(jalv->opts.midi_in);
+	free(jalv->opts.audio_out);
 
 	return 0;
 }
@@ -19,6 +19,7 @@
 #define _BSD_SOURCE     1
 #define _DEFAULT_SOURCE 1
 
+#include <inttypes.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
@@ -37,14 +38,22 @@ print_usage(const char* name, bool error)
 	fprintf(os, "Run an LV2 plugin as a Jack application.\n");
 	fprintf(os, "  -b SIZE      Buffer size for plugin <=> UI communication\n");
 	fprintf(os, "  -c SYM=VAL   Set control value (e.g. \"vol=1.4\")\n");
+	fprintf(os, "  -C MS        Crossfade for MS milliseconds to change presets\n");
 	fprintf(os, "  -d           Dump plugin <=> UI communication\n");
+	fprintf(os, "  -f FILE      Input audio file (jalv.render only)\n");
 	fprintf(os, "  -h           Display this help and exit\n");
+	fprintf(os, "  -I URI       Run an additional instance of plugin URI\n");
 	fprintf(os, "  -l DIR       Load state from save directory\n");
+	fprintf(os, "  -m FILE      Input MIDI file (jalv.render only)\n");
 	fprintf(os, "  -n NAME      JACK client name\n");
+	fprintf(os, "  -o FILE      Output audio file (jalv.render only)\n");
 	fprintf(os, "  -p           Print control output changes to stdout\n");
 	fprintf(os, "  -s           Show plugin UI if possible\n");
+	fprintf(os, "  -S FRAMES    Split runs at control changes, at least FRAMES apart\n");
 	fprintf(os, "  -t           Print trace messages from plugin\n");
+	fprintf(os, "  -T           Print time taken by each startup phase\n");
 	fprintf(os, "  -u UUID      UUID for Jack session restoration\n");
+	fprintf(os, "  -w THREADS   Number of threads to run plugin work in\n");
 	fprintf(os, "  -x           Exact JACK client name (exit if taken)\n");
 	return error ? 1 : 0;
 }
@@ -61,7 +70,8 @@ jalv_ui_port_event(ZIX_UNUSED Jalv*       jalv,
 int
 jalv_init(int* argc, char*** argv, JalvOptions* opts)
 {
-	int n_controls = 0;
+	int n_controls  = 0;
+	int n_instances = 0;
 	int a          = 1;
 	for (; a < *argc && (*argv)[a][0] == '-'; ++a) {
 		if ((*argv)[a][1] == 'h') {
@@ -88,6 +98,24 @@ jalv_init(int* argc, char*** argv, JalvOptions* opts)
 				return 1;
 			}
 			opts->buffer_size = atoi((*argv)[a]);
+		} else if ((*argv)[a][1] == 'S') {
+			if (++a == *argc) {
+				fprintf(stderr, "Missing argument for -S\n");
+				return 1;
+			}
+			opts->min_slice = atoi((*argv)[a]);
+		} else if ((*argv)[a][1] == 'C') {
+			if (++a == *argc) {
+				fprintf(stderr, "Missing argument for -C\n");
+				return 1;
+			}
+			opts->crossfade = atoi((*argv)[a]);
+		} else if ((*argv)[a][1] == 'w') {
+			if (++a == *argc) {
+				fprintf(stderr, "Missing argument for -w\n");
+				return 1;
+			}
+			opts->worker_threads = atoi((*argv)[a]);
 		} else if ((*argv)[a][1] == 'c') {
 			if (++a == *argc) {
 				fprintf(stderr, "Missing argument for -c\n");
@@ -97,12 +125,23 @@ jalv_init(int* argc, char*** argv, JalvOptions* opts)
 				opts->controls, (++n_controls + 1) * sizeof(char*));
 			opts->controls[n_controls - 1] = (*argv)[a];
 			opts->controls[n_controls]     = NULL;
+		} else if ((*argv)[a][1] == 'I') {
+			if (++a == *argc) {
+				fprintf(stderr, "Missing argument for -I\n");
+				return 1;
+			}
+			opts->instances = (char**)realloc(
+				opts->instances, (++n_instances + 1) * sizeof(char*));
+			opts->instances[n_instances - 1] = (*argv)[a];
+			opts->instances[n_instances]     = NULL;
 		} else if ((*argv)[a][1] == 'i') {
 			opts->non_interactive = true;
 		} else if ((*argv)[a][1] == 'd') {
 			opts->dump = true;
 		} else if ((*argv)[a][1] == 't') {
 			opts->trace = true;
+		} else if ((*argv)[a][1] == 'T') {
+			opts->timings = true;
 		} else if ((*argv)[a][1] == 'n') {
 			if (++a == *argc) {
 				fprintf(stderr, "Missing argument for -n\n");
@@ -112,6 +151,27 @@ jalv_init(int* argc, char*** argv, JalvOptions* opts)
 			opts->name = jalv_strdup((*argv)[a]);
 		} else if ((*argv)[a][1] == 'x') {
 			opts->name_exact = 1;
+		} else if ((*argv)[a][1] == 'f') {
+			if (++a == *argc) {
+				fprintf(stderr, "Missing argument for -f\n");
+				return 1;
+			}
+			free(opts->audio_in);
+			opts->audio_in = jalv_strdup((*argv)[a]);
+		} else if ((*argv)[a][1] == 'm') {
+			if (++a == *argc) {
+				fprintf(stderr, "Missing argument for -m\n");
+				return 1;
+			}
+			free(opts->midi_in);
+			opts->midi_in = jalv_strdup((*argv)[a]);
+		} else if ((*argv)[a][1] == 'o') {
+			if (++a == *argc) {
+				fprintf(stderr, "Missing argument for -o\n");
+				return 1;
+			}
+			free(opts->audio_out);
+			opts->audio_out = jalv_strdup((*argv)[a]);
 		} else {
 			fprintf(stderr, "Unknown option %s\n", (*argv)[a]);
 			return print_usage((*argv)[0], true);
@@ -152,12 +212,94 @@ jalv_print_preset(Jalv*           jalv,
 	return 0;
 }
 
+/** Print a statistic, prefixed like port names for additional instances. */
+static void
+jalv_print_stat(const Jalv* jalv, const char* name, uint64_t value)
+{
+	if (jalv->instance_index) {
+		printf("%u_%s = %" PRIu64 "\n", jalv->instance_index, name, value);
+	} else {
+		printf("%s = %" PRIu64 "\n", name, value);
+	}
+}
+
+/** Print the non-empty buckets of a histogram as NAME_lt_LIMITUNIT. */
+static void
+jalv_print_histogram(const Jalv*          jalv,
+                     const char*          name,
+                     const char*          unit,
+                     const JalvHistogram* hist)
+{
+	char stat[64];
+	for (uint32_t i = 0; i < JALV_N_BUCKETS; ++i) {
+		const uint32_t count = zix_atomic_load(&hist->counts[i]);
+		if (!count) {
+			continue;
+		} else if (i == JALV_N_BUCKETS - 1) {
+			snprintf(stat, sizeof(stat), "%s_ge_%" PRIu64 "%s",
+			         name, (uint64_t)1 << (i - 1), unit);
+		} else {
+			snprintf(stat, sizeof(stat), "%s_lt_%" PRIu64 "%s",
+			         name, (uint64_t)1 << i, unit);
+		}
+		jalv_print_stat(jalv, stat, count);
+	}
+}
+
+static void
+jalv_print_worker_stats(const Jalv* jalv)
+{
+	const JalvWorkerStats* const stats = &jalv->worker.stats;
+	jalv_print_stat(jalv, "work_requests",
+	                zix_atomic_load(&stats->n_requests));
+	jalv_print_stat(jalv, "work_responses",
+	                zix_atomic_load(&stats->n_responses));
+	jalv_print_stat(jalv, "work_max_queued",
+	                zix_atomic_load(&stats->max_queued));
+	jalv_print_stat(jalv, "work_max_request_bytes",
+	                zix_atomic_load(&stats->max_requests));
+	jalv_print_stat(jalv, "work_max_response_bytes",
+	                zix_atomic_load(&stats->max_responses));
+	jalv_print_stat(jalv, "work_deferred_responses",
+	                zix_atomic_load(&stats->n_deferred));
+	jalv_print_histogram(jalv, "work_wait", "us", &stats->wait);
+	jalv_print_histogram(jalv, "work_time", "us", &stats->work);
+	jalv_print_histogram(jalv, "work_delay", "periods", &stats->delay);
+}
+
+static void
+jalv_print_stats(Jalv* jalv)
+{
+	for (uint32_t i = 0; i <= jalv->n_instances; ++i) {
+		const Jalv* const inst = i ? jalv->instances[i - 1] : jalv;
+		jalv_print_stat(inst, "frames", inst->frame_time);
+		jalv_print_stat(inst, "reconnects", inst->n_reconnects);
+		if (inst->worker.threaded) {
+			jalv_print_worker_stats(inst);
+		}
+	}
+	jalv_print_stat(jalv, "log_drops", zix_atomic_load(&jalv->n_log_drops));
+	jalv_print_stat(jalv, "ui_drops", zix_atomic_load(&jalv->n_ui_drops));
+	jalv_print_stat(jalv, "plugin_drops",
+	                zix_atomic_load(&jalv->n_plugin_drops));
+	for (uint32_t i = 0; i < jalv->num_ports; ++i) {
+		const struct Port* const port    = &jalv->ports[i];
+		const uint32_t           n_drops = zix_atomic_load(&port->n_drops);
+		if (n_drops) {
+			const LilvNode* sym = lilv_port_get_symbol(jalv->plugin,
+			                                           port->lilv_port);
+			printf("%s_drops = %u\n", lilv_node_as_string(sym), n_drops);
+		}
+	}
+}
+
 static void
 jalv_process_command(Jalv* jalv, const char* cmd)
 {
 	char     sym[64];
 	uint32_t index;
 	float    value;
+	uint64_t frame;
 	if (!strncmp(cmd, "help", 4)) {
 		fprintf(stderr,
 		        "Commands:\n"
@@ -168,9 +310,10 @@ jalv_process_command(Jalv* jalv, const char* cmd)
 		        "  preset URI        Set preset\n"
 		        "  set INDEX VALUE   Set control value by port index\n"
 		        "  set SYMBOL VALUE  Set control value by symbol\n"
-		        "  SYMBOL = VALUE    Set control value by symbol\n");
+		        "  SYMBOL = VALUE    Set control value by symbol\n"
+		        "  at FRAME SYM VAL  Set control value at frame time\n"
+		        "  stats             Print processing statistics\n");
 	} else if (strcmp(cmd, "presets\n") == 0) {
-		jalv_unload_presets(jalv);
 		jalv_load_presets(jalv, jalv_print_preset, NULL);
 	} else if (sscanf(cmd, "preset %[a-zA-Z0-9_:/-.#]\n", sym) == 1) {
 		LilvNode* preset = lilv_new_uri(jalv->world, sym);
@@ -181,6 +324,17 @@ jalv_process_command(Jalv* jalv, const char* cmd)
 		jalv_print_controls(jalv, true, false);
 	} else if (strcmp(cmd, "monitors\n") == 0) {
 		jalv_print_controls(jalv, false, true);
+	} else if (strcmp(cmd, "stats\n") == 0) {
+		jalv_print_stats(jalv);
+	} else if (sscanf(cmd, "at %" SCNu64 " %[a-zA-Z0-9_] %f",
+	                  &frame, sym, &value) == 3) {
+		ControlID* control = jalv_control_by_symbol(jalv, sym);
+		if (control && control->value_type == jalv->forge.Float) {
+			jalv_set_control_at(control, frame, sizeof(value),
+			                    jalv->forge.Float, &value);
+		} else {
+			fprintf(stderr, "error: no float control named `%s'\n", sym);
+		}
 	} else if (sscanf(cmd, "set %u %f", &index, &value) == 2) {
 		if (index < jalv->num_ports) {
 			jalv->ports[index].control = value;
@@ -106,6 +106,8 @@ jalv_init(int* argc, char*** argv, JalvOptions* opts)
 		  "Dump plugin <=> UI communication", NULL },
 		{ "trace", 't', 0, G_OPTION_ARG_NONE, &opts->trace,
 		  "Print trace messages from plugin", NULL },
+		{ "timings", 'T', 0, G_OPTION_ARG_NONE, &opts->timings,
+		  "Print time taken by each startup phase", NULL },
 		{ "show-hidden", 's', 0, G_OPTION_ARG_NONE, &opts->show_hidden,
 		  "Show controls for ports with notOnGUI property on generic UI", NULL },
 		{ "no-menu", 'n', 0, G_OPTION_ARG_NONE, &opts->no_menu,
@@ -114,10 +116,18 @@ jalv_init(int* argc, char*** argv, JalvOptions* opts)
 		  "Use Jalv generic UI and not the plugin UI", NULL},
 		{ "buffer-size", 'b', 0, G_OPTION_ARG_INT, &opts->buffer_size,
 		  "Buffer size for plugin <=> UI communication", "SIZE"},
+		{ "min-slice", 'S', 0, G_OPTION_ARG_INT, &opts->min_slice,
+		  "Split runs at control changes, at least FRAMES apart", "FRAMES"},
+		{ "worker-threads", 'w', 0, G_OPTION_ARG_INT, &opts->worker_threads,
+		  "Number of threads to run plugin work in", "THREADS"},
+		{ "crossfade", 'C', 0, G_OPTION_ARG_INT, &opts->crossfade,
+		  "Crossfade for MS milliseconds to change presets", "MS"},
 		{ "update-frequency", 'r', 0, G_OPTION_ARG_DOUBLE, &opts->update_rate,
 		  "UI update frequency", NULL},
 		{ "control", 'c', 0, G_OPTION_ARG_STRING_ARRAY, &opts->controls,
 		  "Set control value (e.g. \"vol=1.4\")", NULL},
+		{ "instance", 'I', 0, G_OPTION_ARG_STRING_ARRAY, &opts->instances,
+		  "Run an additional instance of plugin URI", "URI"},
 		{ "print-controls", 'p', 0, G_OPTION_ARG_NONE, &opts->print_controls,
 		  "Print control output changes to stdout", NULL},
 		{ "jack-name", 'n', 0, G_OPTION_ARG_STRING, &opts->name,
@@ -20,6 +20,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#ifdef _WIN32
+#    include <windows.h>
+#endif
 #ifdef HAVE_ISATTY
 #    include <unistd.h>
 #endif
@@ -41,6 +45,7 @@
 #include "lv2/urid/urid.h"
 #include "lv2/worker/worker.h"
 
+#include "zix/atomic.h"
 #include "zix/ring.h"
 #include "zix/sem.h"
 #include "zix/thread.h"
@@ -60,8 +65,19 @@
 extern "C" {
 #endif
 
+/* Size factor for UI ring buffers.  The ring size is a few times the size of
+   an event output to give the UI a chance to keep up.  Experiments with Ingen,
+   which can highly saturate its event output, led me to this value.  It
+   really ought to be enough for anybody(TM).
+*/
+#define N_BUFFER_CYCLES 16
+
 typedef struct JalvBackend JalvBackend;
 
+typedef struct JalvWorkerPool JalvWorkerPool;
+
+typedef struct JalvLogSlot JalvLogSlot;
+
 typedef struct Jalv Jalv;
 
 enum PortFlow {
@@ -84,12 +100,38 @@ struct Port {
 	enum PortFlow   flow;       ///< Data flow direction
 	void*           sys_port;   ///< For audio/MIDI ports, otherwise NULL
 	LV2_Evbuf*      evbuf;      ///< For MIDI ports, otherwise NULL
+	LV2_Evbuf*      sub_evbuf;  ///< For MIDI ports when splitting runs
+	void*           buffer;     ///< Buffer last connected by process thread
 	void*           widget;     ///< Control widget, if applicable
 	size_t          buf_size;   ///< Custom buffer size, or 0
+	uint32_t        n_drops;    ///< Events to UI dropped (ring full)
+	uint32_t        ui_value;   ///< Latest control value for UI (float bits)
+	uint32_t        ui_dirty;   ///< Non-zero iff ui_value is new to the UI
 	uint32_t        index;      ///< Port index
 	float           control;    ///< For control ports, otherwise 0.0f
+	bool            midi;       ///< Event port supports MIDI (set by backend)
 };
 
+/**
+   Indices of ports grouped by role, built once after ports are activated.
+
+   This allows the process thread to visit only the ports it needs to without
+   checking the type and flow of every port in every cycle.
+*/
+typedef struct {
+	uint32_t* audio_in;       ///< Audio and CV inputs
+	uint32_t* audio_out;      ///< Audio and CV outputs
+	uint32_t* event_in;       ///< Event inputs
+	uint32_t* event_out;      ///< Event outputs
+	uint32_t* control_out;    ///< Control outputs (excluding latency)
+	uint32_t  n_audio_in;     ///< Number of audio and CV inputs
+	uint32_t  n_audio_out;    ///< Number of audio and CV outputs
+	uint32_t  n_event_in;     ///< Number of event inputs
+	uint32_t  n_event_out;    ///< Number of event outputs
+	uint32_t  n_control_out;  ///< Number of control outputs
+	uint32_t  latency_port;   ///< Index of latency output, or UINT32_MAX
+} JalvProcessPlan;
+
 /* Controls */
 
 /** Type of plugin control. */
@@ -131,6 +173,10 @@ typedef struct {
 	bool        is_readable;     ///< Readable (output)
 } ControlID;
 
+/** Scale the range of an lv2:sampleRate control by the sample rate. */
+void
+scale_sample_rate_range(Jalv* jalv, ControlID* control);
+
 ControlID*
 new_port_control(Jalv* jalv, uint32_t index);
 
@@ -150,12 +196,21 @@ get_property_control(const Controls* controls, LV2_URID property);
 
 /**
    Control change event, sent through ring buffers for UI updates.
+
+   Events from the UI are applied in the cycle that contains their frame time,
+   at the corresponding offset.  A time of zero, or any time that has already
+   passed, is applied at the start of the next cycle.
+
+   The body is written immediately after the header, so the header is padded
+   to make `body` start at exactly sizeof(ControlChange).
 */
 typedef struct {
-	uint32_t index;
-	uint32_t protocol;
-	uint32_t size;
-	uint8_t  body[];
+	uint64_t time;      ///< Frame time to apply at (UI to plugin only)
+	uint32_t index;     ///< Port index
+	uint32_t protocol;  ///< Port protocol, or 0 for float
+	uint32_t size;      ///< Size of body in bytes
+	uint32_t pad;       ///< Padding so body is at sizeof(ControlChange)
+	uint8_t  body[];    ///< Event body
 } ControlChange;
 
 typedef struct {
@@ -165,16 +220,24 @@ typedef struct {
 	char*    load;              ///< Path for state to load
 	char*    preset;            ///< URI of preset to load
 	char**   controls;          ///< Control values
+	char**   instances;         ///< URIs of additional plugins to instantiate
 	uint32_t buffer_size;       ///< Plugin <= >UI communication buffer size
+	uint32_t min_slice;         ///< Minimum sub-run length, or 0 to not split
+	uint32_t worker_threads;    ///< Number of worker threads
+	uint32_t crossfade;         ///< Preset crossfade length in ms, or 0
 	double   update_rate;       ///< UI update rate in Hz
 	int      dump;              ///< Dump communication iff true
 	int      trace;             ///< Print trace log iff true
+	int      timings;           ///< Print startup phase timings iff true
 	int      generic_ui;        ///< Use generic UI iff true
 	int      show_hidden;       ///< Show controls for notOnGUI ports
 	int      no_menu;           ///< Hide menu iff true
 	int      show_ui;           ///< Show non-embedded UI
 	int      print_controls;    ///< Print control changes to stdout
 	int      non_interactive;   ///< Do not listen for commands on stdin
+	char*    audio_in;          ///< Input audio file for offline rendering
+	char*    midi_in;           ///< Input MIDI file for offline rendering
+	char*    audio_out;         ///< Output audio file for offline rendering
 } JalvOptions;
 
 typedef struct {
@@ -215,6 +278,7 @@ typedef struct {
 	LilvNode* atom_Float;
 	LilvNode* atom_Path;
 	LilvNode* atom_Sequence;
+	LilvNode* jalv_threadSafeWork;
 	LilvNode* lv2_AudioPort;
 	LilvNode* lv2_CVPort;
 	LilvNode* lv2_ControlPort;
@@ -254,15 +318,123 @@ typedef enum {
 	JALV_PAUSED
 } JalvPlayState;
 
+/** Number of buckets in a JalvHistogram. */
+#define JALV_N_BUCKETS 26
+
+/**
+   Histogram with a bucket for every power of two.
+
+   Bucket 0 counts zero, and every other bucket i counts values in
+   [2^(i-1), 2^i), except the last which counts everything larger.  Buckets
+   are incremented atomically, so values may be added from any thread.
+*/
+typedef struct {
+	uint32_t counts[JALV_N_BUCKETS];
+} JalvHistogram;
+
+/**
+   A preset of the plugin, listed without loading all of its data.
+
+   Presets are usually labeled in their bundle manifest, so the label is
+   known before the preset itself is loaded.
+*/
+typedef struct {
+	LilvNode* uri;     ///< Preset URI
+	LilvNode* label;   ///< Label (rdfs:label)
+	bool      loaded;  ///< True iff preset data is loaded into the world
+} JalvPreset;
+
+/** Progress of a crossfade to a new instance, see JalvCrossfade. */
+typedef enum {
+	JALV_FADE_IDLE,   ///< No crossfade in progress
+	JALV_FADE_READY,  ///< New instance is ready, process thread fades to it
+	JALV_FADE_DONE    ///< New instance swapped in, old instance can be freed
+} JalvFadeState;
+
+/**
+   Crossfade from the running instance to a new one with different state.
+
+   The new instance is instantiated and restored in another thread, so the
+   running instance never needs to be paused.  The process thread then runs
+   both and fades between their outputs, before replacing the old instance
+   with the new one at the end of a cycle.
+
+   The process thread only runs the fade while it holds the lock, so the
+   other thread can cancel it if the plugin is no longer being run.
+*/
+typedef struct {
+	LilvInstance* instance;  ///< New instance, then old instance when done
+	float*        audio;     ///< Audio and CV outputs of the new instance
+	float*        controls;  ///< Control values of the new instance
+	LV2_Evbuf**   events;    ///< Event outputs of the new instance
+	uint32_t      capacity;  ///< Frames in each audio output buffer
+	uint32_t      length;    ///< Length of crossfade in frames
+	uint32_t      position;  ///< Frames faded so far
+	uint32_t      state;     ///< JalvFadeState, accessed atomically
+	uint32_t      lock;      ///< Non-zero while a thread uses the fade
+} JalvCrossfade;
+
+/** Wall clock and CPU time, for timing startup phases. */
+typedef struct {
+	uint64_t wall;  ///< Monotonic wall clock time (us)
+	uint64_t cpu;   ///< CPU time used by the process (us)
+} JalvTimestamp;
+
+/** Worker statistics, written by the audio and worker threads. */
+typedef struct {
+	JalvHistogram wait;          ///< Time requests are queued (us)
+	JalvHistogram work;          ///< Time spent in work() (us)
+	JalvHistogram delay;         ///< Responses queued before run (periods)
+	uint32_t      n_requests;    ///< Requests scheduled
+	uint32_t      n_responses;   ///< Responses delivered to the plugin
+	uint32_t      n_queued;      ///< Requests scheduled and not yet started
+	uint32_t      n_cycles;      ///< Number of times responses were emitted
+	uint32_t      n_deferred;    ///< Times the response ring was full
+	uint32_t      max_queued;    ///< High-water mark of n_queued
+	uint32_t      max_requests;  ///< High-water mark of request ring (bytes)
+	uint32_t      max_responses; ///< High-water mark of response ring (bytes)
+} JalvWorkerStats;
+
+/**
+   Priority of a work request, from highest to lowest.
+
+   Requests are classified by what caused the run() cycle that scheduled them.
+   The requests of an instance always run in the order they were scheduled,
+   but pool threads serve the instance with the most urgent queued request
+   first, so a preset change is not stuck behind background work of other
+   instances.  Work that is already running is not interrupted.
+*/
+typedef enum {
+	JALV_WORK_RESTORE,      ///< Scheduled in the first cycle after a restore
+	JALV_WORK_INTERACTIVE,  ///< Scheduled in a cycle with events from the UI
+	JALV_WORK_BACKGROUND,   ///< Scheduled in any other cycle
+	JALV_N_WORK_PRIORITIES
+} JalvWorkPriority;
+
+struct JalvWorkJob;
+
 typedef struct {
 	Jalv*                       jalv;       ///< Pointer back to Jalv
+	JalvWorkerPool*             pool;       ///< Threads that run requests
 	ZixRing*                    requests;   ///< Requests to the worker
+	uint32_t                    n_pending[JALV_N_WORK_PRIORITIES]; ///< By priority
 	ZixRing*                    responses;  ///< Responses from the worker
+	uint32_t                    buf_size;   ///< Capacity of rings and buffers
+	void*                       request;    ///< Worker request buffer (serial)
 	void*                       response;   ///< Worker response buffer
-	ZixSem                      sem;        ///< Worker semaphore
-	ZixThread                   thread;     ///< Worker thread
+	ZixSem                      lock;       ///< Lock for concurrent requests
+	uint32_t                    busy;       ///< Non-zero while running serially
+	uint32_t                    n_started;  ///< Requests read (concurrent)
+	uint32_t                    n_finished; ///< Requests responded (concurrent)
+	struct JalvWorkJob*         jobs;       ///< Preallocated jobs (concurrent)
+	struct JalvWorkJob*         free_jobs;  ///< Jobs available for requests
+	struct JalvWorkJob*         finished;   ///< Jobs waiting for earlier ones
+	uint32_t                    deferred;   ///< Non-zero if responses wait
+	JalvWorkerStats             stats;      ///< Latency and queue statistics
+	JalvWorkPriority            priority;   ///< Priority of requests this cycle
 	const LV2_Worker_Interface* iface;      ///< Plugin worker interface
 	bool                        threaded;   ///< Run work in another thread
+	bool                        concurrent; ///< Plugin work() is thread-safe
 } JalvWorker;
 
 typedef struct {
@@ -295,21 +467,42 @@ struct Jalv {
 	Sratom*            sratom;         ///< Atom serialiser
 	Sratom*            ui_sratom;      ///< Atom serialiser for UI thread
 	Symap*             symap;          ///< URI map
-	ZixSem             symap_lock;     ///< Lock for URI map
+	ZixSem             symap_lock;     ///< Lock for adding URIs to map
+	JalvLogSlot*       log_slots;      ///< Queue of log messages from plugins
+	uint32_t           log_head;       ///< Index of next message to print
+	uint32_t           log_tail;       ///< Index of next message to write
+	ZixSem             log_sem;        ///< Log message available signal
+	ZixThread          log_thread;     ///< Thread that prints log messages
+	uint32_t           n_log_drops;    ///< Log messages dropped
+	uint32_t           log_reported;   ///< Log drops already reported
 	JalvBackend*       backend;        ///< Audio system backend
 	ZixRing*           ui_events;      ///< Port events from UI
 	ZixRing*           plugin_events;  ///< Port events from plugin
+	uint32_t           n_ui_drops;     ///< Events dropped (ui_events full)
+	uint32_t           n_plugin_drops; ///< Events dropped (plugin_events full)
+	uint32_t           drops_reported; ///< Plugin drops already reported
+	uint32_t           controls_dirty; ///< Non-zero iff any ui_dirty is set
+	uint32_t           restored;       ///< Non-zero if state was just restored
 	void*              ui_event_buf;   ///< Buffer for reading UI port events
+	uint32_t           ui_event_cap;   ///< Size of ui_event_buf in bytes
+	uint8_t*           ui_pending;     ///< UI events scheduled for later cycles
+	uint32_t           ui_pending_len; ///< Bytes used in ui_pending
+	uint32_t           ui_pending_cap; ///< Size of ui_pending in bytes
 	JalvWorker         worker;         ///< Worker thread implementation
 	JalvWorker         state_worker;   ///< Synchronous worker for state restore
+	JalvWorkerPool*    worker_pool;    ///< Worker threads shared by instances
 	ZixSem             work_lock;      ///< Lock for plugin work() method
 	ZixSem             done;           ///< Exit semaphore
 	ZixSem             paused;         ///< Paused signal from process thread
+	JalvCrossfade      crossfade;      ///< Preset crossfade, if any
 	JalvPlayState      play_state;     ///< Current play state
 	char*              temp_dir;       ///< Temporary plugin state directory
 	char*              save_dir;       ///< Plugin save directory
 	const LilvPlugin*  plugin;         ///< Plugin class (RDF data)
 	LilvState*         preset;         ///< Current preset
+	JalvPreset*        presets;        ///< Preset index, built when needed
+	uint32_t           n_presets;      ///< Number of indexed presets
+	bool               have_presets;   ///< True iff presets is up to date
 	LilvUIs*           uis;            ///< All plugin UIs (RDF data)
 	const LilvUI*      ui;             ///< Plugin UI (RDF data)
 	const LilvNode*    ui_type;        ///< Plugin UI type (unwrapped)
@@ -320,6 +513,7 @@ struct Jalv {
 #endif
 	void*              window;         ///< Window (if applicable)
 	struct Port*       ports;          ///< Port array of size num_ports
+	JalvProcessPlan    plan;           ///< Port indices for processing
 	Controls           controls;       ///< Available plugin controls
 	uint32_t           block_length;   ///< Audio buffer size (block length)
 	size_t             midi_buf_size;  ///< Size of MIDI port buffers
@@ -329,6 +523,7 @@ struct Jalv {
 	float              ui_update_hz;   ///< Frequency of UI updates
 	float              sample_rate;    ///< Sample rate
 	uint32_t           event_delta_t;  ///< Frames since last update sent to UI
+	uint64_t           frame_time;     ///< Frames run since activation
 	uint32_t           position;       ///< Transport position in frames
 	float              bpm;            ///< Transport tempo in beats per minute
 	bool               rolling;        ///< Transport speed (0=stop, 1=play)
@@ -339,6 +534,12 @@ struct Jalv {
 	bool               safe_restore;   ///< Plugin restore() is thread-safe
 	JalvFeatures       features;
 	const LV2_Feature** feature_list;
+	Jalv*              host;           ///< Instance with shared state, or NULL
+	Jalv**             instances;      ///< Additional hosted instances
+	uint32_t           n_instances;    ///< Number of additional instances
+	uint32_t           instance_index; ///< Index of this instance (0 for host)
+	uint32_t           n_reconnects;   ///< Port connections made while running
+	JalvTimestamp      phase_start;    ///< Start of current startup phase
 };
 
 int
@@ -372,12 +573,29 @@ jalv_create_ports(Jalv* jalv);
 void
 jalv_allocate_port_buffers(Jalv* jalv);
 
+/** Build the process plan, after all ports have been activated. */
+void
+jalv_build_process_plan(Jalv* jalv);
+
 struct Port*
 jalv_port_by_symbol(Jalv* jalv, const char* sym);
 
 void
 jalv_create_controls(Jalv* jalv, bool writable);
 
+/**
+   Create ports and controls from the port cache.
+
+   Returns zero on success, or non-zero if the plugin is not cached or its
+   data has changed since, in which case nothing is created.
+*/
+int
+jalv_load_port_cache(Jalv* jalv);
+
+/** Write the ports and controls created from plugin data to the cache. */
+void
+jalv_save_port_cache(Jalv* jalv);
+
 ControlID*
 jalv_control_by_symbol(Jalv* jalv, const char* sym);
 
@@ -387,6 +605,14 @@ jalv_set_control(const ControlID* control,
                  LV2_URID         type,
                  const void*      body);
 
+/** Set a control at a given frame time, see jalv_ui_write_at(). */
+void
+jalv_set_control_at(const ControlID* control,
+                    uint64_t         time,
+                    uint32_t         size,
+                    LV2_URID         type,
+                    const void*      body);
+
 const char*
 jalv_native_ui_type(void);
 
@@ -417,6 +643,15 @@ jalv_ui_write(void* const    controller,
               uint32_t       protocol,
               const void*    buffer);
 
+/** Write a port event from the UI to be applied at a given frame time. */
+void
+jalv_ui_write_at(Jalv*       jalv,
+                 uint64_t    time,
+                 uint32_t    port_index,
+                 uint32_t    buffer_size,
+                 uint32_t    protocol,
+                 const void* buffer);
+
 void
 jalv_apply_ui_events(Jalv* jalv, uint32_t nframes);
 
@@ -453,6 +688,10 @@ jalv_load_presets(Jalv* jalv, PresetSink sink, void* data);
 int
 jalv_unload_presets(Jalv* jalv);
 
+/** Load the data of a preset if necessary, and return its state. */
+LilvState*
+jalv_load_preset(Jalv* jalv, const LilvNode* preset);
+
 int
 jalv_apply_preset(Jalv* jalv, const LilvNode* preset);
 
@@ -493,6 +732,116 @@ jalv_print_control(Jalv* jalv, const struct Port* port, float value)
 	printf("%s = %f\n", lilv_node_as_string(sym), value);
 }
 
+/**
+   Connect a port to `buf` in the process thread, if it is not already.
+
+   Many backends provide the same buffer every cycle, so this avoids calling
+   the plugin's connect_port() method when nothing has changed.
+*/
+static inline void
+jalv_connect_port(Jalv* jalv, uint32_t port_index, void* buf)
+{
+	struct Port* const port = &jalv->ports[port_index];
+	if (buf != port->buffer) {
+		lilv_instance_connect_port(jalv->instance, port_index, buf);
+		port->buffer = buf;
+		++jalv->n_reconnects;
+	}
+}
+
+/**
+   Publish the value of a control port to be shown in the UI.
+
+   Only the latest value of each port is kept, so this never fails.  It is
+   real-time safe, and jalv_update() sends changed values to the UI.
+*/
+static inline void
+jalv_publish_control(Jalv* jalv, struct Port* port, float value)
+{
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	if (bits != zix_atomic_load(&port->ui_value)) {
+		zix_atomic_store(&port->ui_value, bits);
+		zix_atomic_store(&port->ui_dirty, 1);
+		zix_atomic_store(&jalv->controls_dirty, 1);
+	}
+}
+
+/**
+   Count an event for the UI that was dropped because plugin_events is full.
+
+   This is real-time safe, drops are reported later by jalv_update().
+*/
+static inline void
+jalv_count_drop(Jalv* jalv, uint32_t port_index)
+{
+	zix_atomic_add(&jalv->ports[port_index].n_drops, 1);
+	zix_atomic_add(&jalv->n_plugin_drops, 1);
+}
+
+/**
+   Write a message with a header and body to `ring` all at once.
+
+   This is the framing used for every ring between threads: a ControlChange
+   header for UI events, and a uint32_t size for worker requests and
+   responses.  The reader never sees a header without its body, and if there
+   is not enough space, nothing is written and false is returned.
+*/
+static inline bool
+jalv_ring_write_message(ZixRing*    ring,
+                        const void* header,
+                        uint32_t    header_size,
+                        const void* body,
+                        uint32_t    body_size)
+{
+	ZixRingTransaction tx = zix_ring_begin_write(ring);
+	if (zix_ring_amend_write(ring, &tx, header, header_size) ||
+	    zix_ring_amend_write(ring, &tx, body, body_size)) {
+		return false;
+	}
+
+	zix_ring_commit_write(ring, &tx);
+	return true;
+}
+
+/** Return the current monotonic time in microseconds, real-time safe. */
+static inline uint64_t
+jalv_time_us(void)
+{
+#ifdef _WIN32
+	LARGE_INTEGER count;
+	LARGE_INTEGER freq;
+	QueryPerformanceCounter(&count);
+	QueryPerformanceFrequency(&freq);
+	return (uint64_t)(count.QuadPart / freq.QuadPart * 1000000 +
+	                  count.QuadPart % freq.QuadPart * 1000000 / freq.QuadPart);
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+#endif
+}
+
+/** Add `value` to the matching bucket of `hist`. */
+static inline void
+jalv_histogram_add(JalvHistogram* hist, uint64_t value)
+{
+	uint32_t i = 0;
+	while (i < JALV_N_BUCKETS - 1 && value >= ((uint64_t)1 << i)) {
+		++i;
+	}
+	zix_atomic_add(&hist->counts[i], 1);
+}
+
+/** Raise the high-water mark `*max` to `value` if it is higher. */
+static inline void
+jalv_update_max(uint32_t* max, uint32_t value)
+{
+	if (value > zix_atomic_load(max)) {
+		zix_atomic_store(max, value);
+	}
+}
+
 static inline char*
 jalv_strdup(const char* str)
 {
@@ -516,6 +865,60 @@ jalv_strjoin(const char* a, const char* b)
 	return out;
 }
 
+/**
+   Return the path of a file in the user's cache directory.
+
+   The returned path, for example ~/.cache/jalv/NAME, must be freed.  Returns
+   NULL if there is no cache directory.
+*/
+char*
+jalv_cache_path(const char* name);
+
+/** Create the directories leading to the file at `path`, if necessary. */
+void
+jalv_create_parents(const char* path);
+
+/**
+   Return a path to write a file to before renaming it to `path`.
+
+   The path is unique to this process, so several processes that replace the
+   same file at once do not write to the same temporary file.  The returned
+   path must be freed.
+*/
+char*
+jalv_temp_path(const char* path);
+
+/**
+   Load only the bundles indexed for a plugin and any additional instances.
+
+   Returns zero on success, or non-zero if they are not all indexed or the
+   index is stale, in which case nothing is loaded.
+*/
+int
+jalv_load_indexed_bundles(Jalv* jalv, const char* plugin_uri);
+
+/**
+   Check that the indexed bundles describe every property of the plugins.
+
+   Returns zero on success, or non-zero if a property of the plugin or an
+   additional instance has no range, so it is defined in a bundle that was
+   not loaded.
+*/
+int
+jalv_check_indexed_bundles(Jalv* jalv, const char* plugin_uri);
+
+/** Index the bundles needed by a plugin and any additional instances. */
+void
+jalv_index_bundles(Jalv* jalv, const char* plugin_uri);
+
+/** Start the thread that prints plugin log messages. */
+void
+jalv_log_init(Jalv* jalv);
+
+/** Stop the log thread and print any remaining messages. */
+void
+jalv_log_finish(Jalv* jalv);
+
 int
 jalv_printf(LV2_Log_Handle handle,
             LV2_URID       type,
@@ -14,8 +14,141 @@
   OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
 */
 
+#ifdef HAVE_MLOCK
+#    include <sys/mman.h>
+#endif
+
 #include "jalv_internal.h"
 
+#include "zix/atomic.h"
+
+/** Number of log messages that can be queued, a power of two. */
+#define JALV_LOG_N_SLOTS 64u
+
+/** Maximum length of a log message, longer ones are truncated. */
+#define JALV_LOG_MAX_LENGTH 1024
+
+/**
+   A log message in the log queue.
+
+   The queue is an array of slots shared by all threads that log, which claim
+   the slot at `log_tail` by advancing it with compare and swap.  A slot is
+   free for the message with index `seq`, and holds a message for the log
+   thread to print once `seq` is one past its index, so a message is only
+   dropped if every slot is full.
+*/
+struct JalvLogSlot {
+	uint32_t seq;                        ///< Sequence number, see above
+	LV2_URID type;                       ///< Message type
+	char     text[JALV_LOG_MAX_LENGTH];  ///< Null-terminated message text
+};
+
+/** Print a log message to stderr, from a thread that may block. */
+static int
+jalv_log_print(Jalv* jalv, LV2_URID type, const char* str)
+{
+	bool fancy = true;
+	if (type == jalv->urids.log_Trace && jalv->opts.trace) {
+		jalv_ansi_start(stderr, 32);
+		fprintf(stderr, "trace: ");
+	} else if (type == jalv->urids.log_Error) {
+		jalv_ansi_start(stderr, 31);
+		fprintf(stderr, "error: ");
+	} else if (type == jalv->urids.log_Warning) {
+		jalv_ansi_start(stderr, 33);
+		fprintf(stderr, "warning: ");
+	} else {
+		fancy = false;
+	}
+
+	const int st = fputs(str, stderr);
+
+	if (fancy) {
+		jalv_ansi_reset(stderr);
+	}
+
+	return st;
+}
+
+/** Print all messages in the log queue, and report any new drops. */
+static void
+jalv_log_flush(Jalv* jalv)
+{
+	while (true) {
+		const uint32_t     head = jalv->log_head;
+		JalvLogSlot* const slot = &jalv->log_slots[head % JALV_LOG_N_SLOTS];
+		if (zix_atomic_load(&slot->seq) != head + 1) {
+			break;  // Empty, or the next message is still being written
+		}
+
+		jalv_log_print(jalv, slot->type, slot->text);
+		zix_atomic_store(&slot->seq, head + JALV_LOG_N_SLOTS);
+		jalv->log_head = head + 1;
+	}
+
+	const uint32_t n_drops = zix_atomic_load(&jalv->n_log_drops);
+	if (n_drops != jalv->log_reported) {
+		fprintf(stderr, "warning: Dropped %u plugin log messages\n",
+		        n_drops - jalv->log_reported);
+		jalv->log_reported = n_drops;
+	}
+}
+
+static void*
+jalv_log_func(void* data)
+{
+	Jalv* const jalv = (Jalv*)data;
+	while (true) {
+		zix_sem_wait(&jalv->log_sem);
+		jalv_log_flush(jalv);
+		if (jalv->exit) {
+			break;  // Anything logged later is flushed by jalv_log_finish()
+		}
+	}
+
+	return NULL;
+}
+
+void
+jalv_log_init(Jalv* jalv)
+{
+	jalv->log_slots = (JalvLogSlot*)calloc(
+		JALV_LOG_N_SLOTS, sizeof(JalvLogSlot));
+	for (uint32_t i = 0; i < JALV_LOG_N_SLOTS; ++i) {
+		jalv->log_slots[i].seq = i;
+	}
+#ifdef HAVE_MLOCK
+	mlock(jalv->log_slots, JALV_LOG_N_SLOTS * sizeof(JalvLogSlot));
+#endif
+
+	zix_sem_init(&jalv->log_sem, 0);
+	if (zix_thread_create(&jalv->log_thread, 4096, jalv_log_func, jalv)) {
+		/* Without a thread to drain the queue, print messages directly */
+		fprintf(stderr, "warning: Failed to create log thread\n");
+		zix_sem_destroy(&jalv->log_sem);
+		free(jalv->log_slots);
+		jalv->log_slots = NULL;
+	}
+}
+
+void
+jalv_log_finish(Jalv* jalv)
+{
+	if (!jalv->log_slots) {
+		return;
+	}
+
+	zix_sem_post(&jalv->log_sem);
+	zix_thread_join(jalv->log_thread, NULL);
+
+	/* Plugins are freed and the log thread is finished, flush the rest here */
+	jalv_log_flush(jalv);
+
+	zix_sem_destroy(&jalv->log_sem);
+	free(jalv->log_slots);
+	jalv->log_slots = NULL;
+}
+
 int
 jalv_printf(LV2_Log_Handle handle,
             LV2_URID       type,
@@ -34,27 +167,41 @@ jalv_vprintf(LV2_Log_Handle handle,
              const char*    fmt,
              va_list        ap)
 {
-	// TODO: Lock
-	Jalv* jalv  = (Jalv*)handle;
-	bool  fancy = true;
-	if (type == jalv->urids.log_Trace && jalv->opts.trace) {
-		jalv_ansi_start(stderr, 32);
-		fprintf(stderr, "trace: ");
-	} else if (type == jalv->urids.log_Error) {
-		jalv_ansi_start(stderr, 31);
-		fprintf(stderr, "error: ");
-	} else if (type == jalv->urids.log_Warning) {
-		jalv_ansi_start(stderr, 33);
-		fprintf(stderr, "warning: ");
-	} else {
-		fancy = false;
-	}
+	Jalv* const jalv = (Jalv*)handle;
+	Jalv* const host = jalv->host ? jalv->host : jalv;
 
-	const int st = vfprintf(stderr, fmt, ap);
+	if (!host->log_slots) {
+		char      str[JALV_LOG_MAX_LENGTH];
+		const int len = vsnprintf(str, sizeof(str), fmt, ap);
+		return (len > 0) ? jalv_log_print(jalv, type, str) : len;
+	}
 
-	if (fancy) {
-		jalv_ansi_reset(stderr);
+	/* Claim the next slot, unless the log thread has not printed it yet */
+	JalvLogSlot* slot = NULL;
+	uint32_t     tail = zix_atomic_load(&host->log_tail);
+	while (!slot) {
+		JalvLogSlot* const next = &host->log_slots[tail % JALV_LOG_N_SLOTS];
+		const uint32_t     seq  = zix_atomic_load(&next->seq);
+		if (seq == tail) {
+			const uint32_t prev =
+				zix_atomic_cas(&host->log_tail, tail, tail + 1);
+			slot = (prev == tail) ? next : NULL;
+			tail = prev;
+		} else if ((int32_t)(seq - tail) < 0) {
+			zix_atomic_add(&host->n_log_drops, 1);  // Queue is full
+			return 0;
+		} else {
+			tail = zix_atomic_load(&host->log_tail);  // Taken by another thread
+		}
 	}
 
-	return st;
+	/* Format directly into the slot, then publish it to the log thread */
+	const int len = vsnprintf(slot->text, JALV_LOG_MAX_LENGTH, fmt, ap);
+	if (len < 0) {
+		slot->text[0] = '\0';
+	}
+	slot->type = type;
+	zix_atomic_store(&slot->seq, tail + 1);
+	zix_sem_post(&host->log_sem);
+	return len;
 }
@@ -150,18 +150,17 @@ lv2_evbuf_get(LV2_Evbuf_Iterator iter,
 	return true;
 }
 
-bool
-lv2_evbuf_write(LV2_Evbuf_Iterator* iter,
-                uint32_t            frames,
-                uint32_t            subframes,
-                uint32_t            type,
-                uint32_t            size,
-                const uint8_t*      data)
+uint8_t*
+lv2_evbuf_reserve(LV2_Evbuf_Iterator* iter,
+                  uint32_t            frames,
+                  uint32_t            subframes,
+                  uint32_t            type,
+                  uint32_t            size)
 {
 	LV2_Atom_Sequence* aseq = &iter->evbuf->buf;
 	if (iter->evbuf->capacity - sizeof(LV2_Atom) - aseq->atom.size <
 	    sizeof(LV2_Atom_Event) + size) {
-		return false;
+		return NULL;
 	}
 
 	LV2_Atom_Event* aev = (LV2_Atom_Event*)(
@@ -170,11 +169,62 @@ lv2_evbuf_write(LV2_Evbuf_Iterator* iter,
 	aev->time.frames    = frames;
 	aev->body.type      = type;
 	aev->body.size      = size;
-	memcpy(LV2_ATOM_BODY(&aev->body), data, size);
 
 	size = lv2_evbuf_pad_size(sizeof(LV2_Atom_Event) + size);
 	aseq->atom.size += size;
 	iter->offset += size;
 
+	return (uint8_t*)LV2_ATOM_BODY(&aev->body);
+}
+
+bool
+lv2_evbuf_write(LV2_Evbuf_Iterator* iter,
+                uint32_t            frames,
+                uint32_t            subframes,
+                uint32_t            type,
+                uint32_t            size,
+                const uint8_t*      data)
+{
+	uint8_t* const body = lv2_evbuf_reserve(iter, frames, subframes, type, size);
+	if (!body) {
+		return false;
+	}
+
+	memcpy(body, data, size);
 	return true;
 }
+
+bool
+lv2_evbuf_insert(LV2_Evbuf*     evbuf,
+                 uint32_t       frames,
+                 uint32_t       subframes,
+                 uint32_t       type,
+                 uint32_t       size,
+                 const uint8_t* data)
+{
+	LV2_Atom_Sequence* aseq    = &evbuf->buf;
+	const uint32_t     ev_size =
+		lv2_evbuf_pad_size(sizeof(LV2_Atom_Event) + size);
+	if (evbuf->capacity - sizeof(LV2_Atom) - aseq->atom.size < ev_size) {
+		return false;
+	}
+
+	// Find the first event that is later than the new one
+	char* const contents = (char*)LV2_ATOM_CONTENTS(LV2_Atom_Sequence, aseq);
+	LV2_Evbuf_Iterator iter = lv2_evbuf_begin(evbuf);
+	for (; lv2_evbuf_is_valid(iter); iter = lv2_evbuf_next(iter)) {
+		const LV2_Atom_Event* aev = (const LV2_Atom_Event*)(
+			contents + iter.offset);
+		if (aev->time.frames > (int64_t)frames) {
+			break;
+		}
+	}
+
+	// Move any later events out of the way and write in the gap
+	const uint32_t used = lv2_evbuf_get_size(evbuf);
+	memmove(contents + iter.offset + ev_size,
+	        contents + iter.offset,
+	        used - iter.offset);
+
+	return lv2_evbuf_write(&iter, frames, subframes, type, size, data);
+}
@@ -132,6 +132,33 @@ lv2_evbuf_write(LV2_Evbuf_Iterator* iter,
                 uint32_t            size,
                 const uint8_t*      data);
 
+/**
+   Reserve space for an event at `iter`, and return a pointer to its body.
+   This is like lv2_evbuf_write(), except the caller writes the `size` bytes
+   of the event body directly to the returned pointer.
+   @return Pointer to event body, or NULL if the buffer is full.
+*/
+uint8_t*
+lv2_evbuf_reserve(LV2_Evbuf_Iterator* iter,
+                  uint32_t            frames,
+                  uint32_t            subframes,
+                  uint32_t            type,
+                  uint32_t            size);
+
+/**
+   Insert an event in time order.
+   The event is inserted after any existing events at the same time, so
+   events that are inserted with the same time stay in order.
+   @return True if event was written, otherwise false (buffer is full).
+*/
+bool
+lv2_evbuf_insert(LV2_Evbuf*     evbuf,
+                 uint32_t       frames,
+                 uint32_t       subframes,
+                 uint32_t       type,
+                 uint32_t       size,
+                 const uint8_t* data);
+
 #ifdef __cplusplus
 }
 #endif
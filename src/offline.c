@@ -0,0 +1,633 @@
+/*
+  Copyright 2007-2019 David Robillard <http://drobilla.net>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THIS SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+/**
+   @file offline.c Offline backend which renders files as fast as possible.
+
+   Audio is read from an input file (if given) and the audio outputs of the
+   plugin are written to an output file, with MIDI input optionally read from
+   a Standard MIDI File.  No sound server is involved, the plugin is simply
+   run in a loop in a dedicated thread until the input is exhausted.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE 1  /* for usleep */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sndfile.h>
+
+#include "jalv_internal.h"
+
+#define OFFLINE_BLOCK_LENGTH 1024
+#define OFFLINE_SAMPLE_RATE  48000
+
+#ifndef MIN
+#    define MIN(a, b) (((a) < (b)) ? (a) : (b))
+#endif
+
+/** A MIDI event read from a Standard MIDI File. */
+typedef struct {
+	uint64_t time;   ///< Time in ticks, then in frames once resolved
+	uint32_t seq;    ///< Order in file, to keep sorting stable
+	uint32_t size;   ///< Size of message in bytes
+	uint8_t* data;   ///< Pointer to msg, or to allocated SysEx body
+	uint8_t  msg[3]; ///< Short message
+} MidiEvent;
+
+/** A tempo change read from a Standard MIDI File. */
+typedef struct {
+	uint64_t tick;   ///< Time in ticks
+	uint32_t seq;    ///< Order in file, to keep sorting stable
+	uint32_t tempo;  ///< Microseconds per quarter note
+} MidiTempo;
+
+struct JalvBackend {
+	SNDFILE*   in_file;   ///< Input audio file, or NULL
+	SNDFILE*   out_file;  ///< Output audio file
+	uint32_t   n_in;      ///< Number of channels in input file
+	uint32_t   n_out;     ///< Number of channels in output file
+	float*     in_buf;    ///< Interleaved input buffer
+	float*     out_buf;   ///< Interleaved output buffer
+	MidiEvent* events;    ///< MIDI input events, sorted by time in frames
+	size_t     n_events;  ///< Number of MIDI input events
+	uint64_t   length;    ///< Total number of frames to render
+	ZixThread  thread;    ///< Render thread
+	bool       running;   ///< True iff render thread was launched
+};
+
+static uint32_t
+read_be(const uint8_t* buf, unsigned n)
+{
+	uint32_t value = 0;
+	for (unsigned i = 0; i < n; ++i) {
+		value = (value << 8) | buf[i];
+	}
+	return value;
+}
+
+/** Read a variable-length quantity, returning false if truncated. */
+static bool
+read_vlq(const uint8_t** ptr, const uint8_t* end, uint32_t* value)
+{
+	*value = 0;
+	for (unsigned i = 0; i < 4 && *ptr < end; ++i) {
+		const uint8_t byte = *(*ptr)++;
+		*value = (*value << 7) | (byte & 0x7F);
+		if (!(byte & 0x80)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static int
+midi_event_cmp(const void* a, const void* b)
+{
+	const MidiEvent* ea = (const MidiEvent*)a;
+	const MidiEvent* eb = (const MidiEvent*)b;
+	if (ea->time != eb->time) {
+		return ea->time < eb->time ? -1 : 1;
+	}
+	return ea->seq < eb->seq ? -1 : ea->seq > eb->seq;
+}
+
+static int
+midi_tempo_cmp(const void* a, const void* b)
+{
+	const MidiTempo* ta = (const MidiTempo*)a;
+	const MidiTempo* tb = (const MidiTempo*)b;
+	if (ta->tick != tb->tick) {
+		return ta->tick < tb->tick ? -1 : 1;
+	}
+	return ta->seq < tb->seq ? -1 : ta->seq > tb->seq;
+}
+
+static MidiEvent*
+append_event(JalvBackend* backend, uint64_t tick, uint32_t seq, uint32_t size)
+{
+	if ((backend->n_events & (backend->n_events - 1)) == 0) {
+		const size_t n = backend->n_events ? backend->n_events * 2 : 64;
+		backend->events = (MidiEvent*)realloc(backend->events,
+		                                      n * sizeof(MidiEvent));
+	}
+
+	MidiEvent* ev = &backend->events[backend->n_events++];
+	ev->time = tick;
+	ev->seq  = seq;
+	ev->size = size;
+	ev->data = (size > sizeof(ev->msg)) ? (uint8_t*)malloc(size) : NULL;
+	return ev;
+}
+
+/**
+   Load all channel, system, and SysEx events from a Standard MIDI File.
+
+   Events from all tracks are merged and converted to times in frames using
+   the tempo map of the file.
+*/
+static bool
+load_midi_file(JalvBackend* backend, const char* path, double rate)
+{
+	FILE* fd = fopen(path, "rb");
+	if (!fd) {
+		fprintf(stderr, "error: Failed to open MIDI file %s\n", path);
+		return false;
+	}
+
+	fseek(fd, 0, SEEK_END);
+	const long file_size = ftell(fd);
+	fseek(fd, 0, SEEK_SET);
+
+	uint8_t* const buf = (uint8_t*)malloc(file_size > 0 ? file_size : 1);
+	const size_t   len = fread(buf, 1, file_size > 0 ? file_size : 0, fd);
+	fclose(fd);
+
+	if (len < 14 || memcmp(buf, "MThd", 4) || read_be(buf + 4, 4) < 6) {
+		fprintf(stderr, "error: %s is not a Standard MIDI File\n", path);
+		free(buf);
+		return false;
+	}
+
+	const uint32_t n_tracks = read_be(buf + 10, 2);
+	const uint32_t division = read_be(buf + 12, 2);
+	const uint8_t* end      = buf + len;
+	const uint8_t* ptr      = buf + 8 + read_be(buf + 4, 4);
+
+	MidiTempo* tempos   = NULL;
+	size_t     n_tempos = 0;
+	uint32_t   seq      = 0;
+	for (uint32_t t = 0; t < n_tracks && ptr + 8 <= end; ++t) {
+		const uint32_t chunk_size = read_be(ptr + 4, 4);
+		const bool     is_track   = !memcmp(ptr, "MTrk", 4);
+		const uint8_t* chunk_end  = ptr + 8 + chunk_size;
+		if (chunk_end > end) {
+			chunk_end = end;
+		}
+
+		const uint8_t* p       = ptr + 8;
+		uint64_t       tick    = 0;
+		uint8_t        running = 0;
+		while (is_track && p < chunk_end) {
+			uint32_t delta = 0;
+			if (!read_vlq(&p, chunk_end, &delta) || p >= chunk_end) {
+				break;
+			}
+			tick += delta;
+
+			uint8_t status = *p;
+			if (status & 0x80) {
+				++p;
+			} else if (running) {
+				status = running;
+			} else {
+				break;  // Data byte without running status, corrupt
+			}
+
+			uint32_t size = 0;
+			if (status == 0xFF) {
+				// Meta event, only tempo is relevant
+				if (p >= chunk_end) {
+					break;
+				}
+				const uint8_t type = *p++;
+				if (!read_vlq(&p, chunk_end, &size) || p + size > chunk_end) {
+					break;
+				} else if (type == 0x51 && size == 3) {
+					tempos = (MidiTempo*)realloc(
+						tempos, (n_tempos + 1) * sizeof(MidiTempo));
+					tempos[n_tempos].tick  = tick;
+					tempos[n_tempos].seq   = seq++;
+					tempos[n_tempos].tempo = read_be(p, 3);
+					++n_tempos;
+				} else if (type == 0x2F) {
+					break;  // End of track
+				}
+				p += size;
+			} else if (status == 0xF0 || status == 0xF7) {
+				// SysEx, stored with a leading 0xF0 for complete messages
+				running = 0;
+				if (!read_vlq(&p, chunk_end, &size) || p + size > chunk_end) {
+					break;
+				}
+				const bool   head = (status == 0xF0);
+				MidiEvent*   ev   = append_event(backend, tick, seq++,
+				                                 size + (head ? 1 : 0));
+				uint8_t*     dst  = ev->data ? ev->data : ev->msg;
+				if (head) {
+					*dst++ = 0xF0;
+				}
+				memcpy(dst, p, size);
+				p += size;
+			} else {
+				if (status < 0xF0) {
+					// Channel message
+					const uint8_t kind = status & 0xF0;
+					running = status;
+					size    = (kind == 0xC0 || kind == 0xD0) ? 2 : 3;
+				} else {
+					// System common message, which cancels running status,
+					// or realtime message (0xF8 and up), which does not
+					if (status < 0xF8) {
+						running = 0;
+					}
+					size = (status == 0xF2) ? 3
+						: (status == 0xF1 || status == 0xF3) ? 2
+						: 1;
+				}
+				if (p + size - 1 > chunk_end) {
+					break;
+				}
+				MidiEvent* ev = append_event(backend, tick, seq++, size);
+				ev->msg[0] = status;
+				memcpy(ev->msg + 1, p, size - 1);
+				p += size - 1;
+			}
+		}
+
+		ptr = chunk_end;
+	}
+	free(buf);
+
+	/* Convert tick times to frames using the tempo map */
+	qsort(backend->events, backend->n_events, sizeof(MidiEvent),
+	      midi_event_cmp);
+	qsort(tempos, n_tempos, sizeof(MidiTempo), midi_tempo_cmp);
+
+	double   seconds   = 0.0;
+	uint64_t last_tick = 0;
+	uint32_t tempo     = 500000;
+	size_t   next      = 0;
+	for (size_t i = 0; i < backend->n_events; ++i) {
+		MidiEvent* const ev = &backend->events[i];
+		if (division & 0x8000) {
+			// SMPTE time, ticks are fixed size
+			const double fps   = (double)(256 - (division >> 8));
+			const double ticks = (double)(division & 0xFF);
+			seconds = ev->time / (fps * ticks);
+		} else {
+			for (; next < n_tempos && tempos[next].tick <= ev->time; ++next) {
+				seconds += (tempos[next].tick - last_tick) *
+					(tempo / 1000000.0) / division;
+				last_tick = tempos[next].tick;
+				tempo     = tempos[next].tempo;
+			}
+			seconds += (ev->time - last_tick) * (tempo / 1000000.0) / division;
+			last_tick = ev->time;
+		}
+
+		ev->time = (uint64_t)(seconds * rate + 0.5);
+		if (!ev->data) {
+			ev->data = ev->msg;
+		}
+	}
+	free(tempos);
+
+	if (backend->n_events) {
+		const uint64_t end_time = backend->events[backend->n_events - 1].time;
+		backend->length = end_time + 1 > backend->length
+			? end_time + 1
+			: backend->length;
+	}
+
+	return true;
+}
+
+/**
+   Run the plugin for one block starting at frame `start`.
+
+   The plugin is always run for a whole block, since it may rely on a fixed
+   block length, but only the first `n_write` frames are written.
+*/
+static void
+offline_run(Jalv* jalv, uint64_t start, uint32_t n_write, size_t* next_event)
+{
+	JalvBackend* const backend = jalv->backend;
+	const uint32_t     nframes = jalv->block_length;
+
+	/* Read input audio, leaving silence after the end of the file */
+	memset(backend->in_buf, 0, sizeof(float) * nframes * backend->n_in);
+	if (backend->in_file) {
+		sf_readf_float(backend->in_file, backend->in_buf, n_write);
+	}
+
+	/* Deinterleave input audio, repeating channels if there are too few */
+	const JalvProcessPlan* const plan     = &jalv->plan;
+	uint32_t                     in_index = 0;
+	for (uint32_t i = 0; i < plan->n_audio_in; ++i) {
+		struct Port* const port = &jalv->ports[plan->audio_in[i]];
+		float* const       buf  = (float*)port->sys_port;
+		if (port->type == TYPE_AUDIO) {
+			const uint32_t c = in_index++ % backend->n_in;
+			for (uint32_t f = 0; f < nframes; ++f) {
+				buf[f] = backend->in_buf[f * backend->n_in + c];
+			}
+		} else {
+			memset(buf, 0, nframes * sizeof(float));
+		}
+	}
+
+	/* Prepare event buffers */
+	for (uint32_t i = 0; i < plan->n_event_in; ++i) {
+		struct Port* const port = &jalv->ports[plan->event_in[i]];
+		lv2_evbuf_reset(port->evbuf, true);
+
+		LV2_Evbuf_Iterator iter = lv2_evbuf_begin(port->evbuf);
+		if (jalv->request_update) {
+			/* Plugin state has changed, request an update */
+			const LV2_Atom_Object get = {
+				{ sizeof(LV2_Atom_Object_Body), jalv->urids.atom_Object },
+				{ 0, jalv->urids.patch_Get } };
+			lv2_evbuf_write(&iter, 0, 0,
+			                get.atom.type, get.atom.size,
+			                (const uint8_t*)LV2_ATOM_BODY(&get));
+		}
+
+		if (port->midi) {
+			/* Write MIDI file input */
+			for (size_t e = *next_event; e < backend->n_events; ++e) {
+				const MidiEvent* const ev = &backend->events[e];
+				if (ev->time >= start + nframes) {
+					break;
+				}
+				lv2_evbuf_write(&iter,
+				                (uint32_t)(ev->time - start), 0,
+				                jalv->urids.midi_MidiEvent,
+				                ev->size, ev->data);
+			}
+		}
+	}
+	for (uint32_t i = 0; i < plan->n_event_out; ++i) {
+		/* Clear event output for plugin to write to */
+		lv2_evbuf_reset(jalv->ports[plan->event_out[i]].evbuf, false);
+	}
+	jalv->request_update = false;
+
+	/* Advance past events in this block */
+	while (*next_event < backend->n_events &&
+	       backend->events[*next_event].time < start + nframes) {
+		++*next_event;
+	}
+
+	/* Run plugin for this cycle */
+	jalv_run(jalv, nframes);
+
+	/* Interleave output audio */
+	uint32_t out_index = 0;
+	for (uint32_t i = 0; i < plan->n_audio_out; ++i) {
+		const struct Port* const port = &jalv->ports[plan->audio_out[i]];
+		if (port->type == TYPE_AUDIO) {
+			const float*   buf = (const float*)port->sys_port;
+			const uint32_t c   = out_index++;
+			for (uint32_t f = 0; f < nframes; ++f) {
+				backend->out_buf[f * backend->n_out + c] = buf[f];
+			}
+		}
+	}
+
+	/* Deliver UI events */
+	for (uint32_t o = 0; jalv->has_ui && o < plan->n_event_out; ++o) {
+		const uint32_t     p    = plan->event_out[o];
+		struct Port* const port = &jalv->ports[p];
+		for (LV2_Evbuf_Iterator i = lv2_evbuf_begin(port->evbuf);
+		     lv2_evbuf_is_valid(i);
+		     i = lv2_evbuf_next(i)) {
+			// Get event from LV2 buffer
+			uint32_t frames, subframes, type, size;
+			uint8_t* body;
+			lv2_evbuf_get(i, &frames, &subframes, &type, &size, &body);
+
+			// Forward event to UI
+			jalv_send_to_ui(jalv, p, type, size, body);
+		}
+	}
+
+	if (out_index == 0) {
+		memset(backend->out_buf, 0, sizeof(float) * nframes);
+	}
+
+	if (sf_writef_float(backend->out_file, backend->out_buf, n_write)
+	    != n_write) {
+		fprintf(stderr, "error: Failed to write output (%s)\n",
+		        sf_strerror(backend->out_file));
+		jalv->exit = true;
+	}
+}
+
+static void*
+offline_render_func(void* data)
+{
+	Jalv* const        jalv    = (Jalv*)data;
+	JalvBackend* const backend = jalv->backend;
+
+	uint64_t pos        = 0;
+	size_t   next_event = 0;
+	while (pos < backend->length && !jalv->exit) {
+		switch (jalv->play_state) {
+		case JALV_PAUSE_REQUESTED:
+			jalv->play_state = JALV_PAUSED;
+			zix_sem_post(&jalv->paused);
+			continue;
+		case JALV_PAUSED:
+			/* Waiting for activation or state restore, time stands still */
+			usleep(1000);
+			continue;
+		default:
+			break;
+		}
+
+		const uint32_t n_write = (uint32_t)MIN(jalv->block_length,
+		                                       backend->length - pos);
+		offline_run(jalv, pos, n_write, &next_event);
+		pos += n_write;
+	}
+
+	fprintf(stderr, "Rendered %llu frames\n", (unsigned long long)pos);
+	zix_sem_post(&jalv->done);
+	return NULL;
+}
+
+static void
+offline_free(JalvBackend* backend)
+{
+	if (backend->in_file) {
+		sf_close(backend->in_file);
+	}
+	if (backend->out_file) {
+		sf_close(backend->out_file);
+	}
+	for (size_t i = 0; i < backend->n_events; ++i) {
+		if (backend->events[i].data != backend->events[i].msg) {
+			free(backend->events[i].data);
+		}
+	}
+	free(backend->events);
+	free(backend->in_buf);
+	free(backend->out_buf);
+	free(backend);
+}
+
+JalvBackend*
+jalv_backend_init(Jalv* jalv)
+{
+	if (!jalv->opts.audio_out) {
+		fprintf(stderr, "error: No output file given (use -o)\n");
+		return NULL;
+	}
+
+	if (!jalv->opts.audio_in && !jalv->opts.midi_in) {
+		/* The length of the output is the length of the input */
+		fprintf(stderr, "error: No input file given (use -f or -m)\n");
+		return NULL;
+	}
+
+	if (jalv->opts.instances) {
+		fprintf(stderr, "warning: Additional instances require JACK\n");
+		free(jalv->opts.instances);
+		jalv->opts.instances = NULL;
+	}
+
+	JalvBackend* const backend = (JalvBackend*)calloc(1, sizeof(JalvBackend));
+	double             rate    = OFFLINE_SAMPLE_RATE;
+
+	/* Open input audio file, which determines the sample rate */
+	backend->n_in = 1;
+	if (jalv->opts.audio_in) {
+		SF_INFO info;
+		memset(&info, 0, sizeof(info));
+		if (!(backend->in_file = sf_open(jalv->opts.audio_in, SFM_READ, &info))) {
+			fprintf(stderr, "error: Failed to open %s (%s)\n",
+			        jalv->opts.audio_in, sf_strerror(NULL));
+			offline_free(backend);
+			return NULL;
+		}
+		rate            = info.samplerate;
+		backend->n_in   = (uint32_t)info.channels;
+		backend->length = (uint64_t)info.frames;
+	}
+
+	/* Load input MIDI file, which may extend the length */
+	if (jalv->opts.midi_in &&
+	    !load_midi_file(backend, jalv->opts.midi_in, rate)) {
+		offline_free(backend);
+		return NULL;
+	}
+
+	/* Open output file with a channel for every audio output */
+	for (uint32_t p = 0; p < jalv->num_ports; ++p) {
+		if (jalv->ports[p].type == TYPE_AUDIO &&
+		    jalv->ports[p].flow == FLOW_OUTPUT) {
+			++backend->n_out;
+		}
+	}
+
+	SF_INFO out_info;
+	memset(&out_info, 0, sizeof(out_info));
+	out_info.samplerate = (int)rate;
+	out_info.channels   = backend->n_out ? (int)backend->n_out : 1;
+	out_info.format     = SF_FORMAT_WAV | SF_FORMAT_FLOAT;
+	if (!(backend->out_file = sf_open(jalv->opts.audio_out, SFM_WRITE,
+	                                  &out_info))) {
+		fprintf(stderr, "error: Failed to open %s (%s)\n",
+		        jalv->opts.audio_out, sf_strerror(NULL));
+		offline_free(backend);
+		return NULL;
+	}
+	backend->n_out = (uint32_t)out_info.channels;
+
+	/* Set audio engine properties */
+	jalv->sample_rate   = (float)rate;
+	jalv->block_length  = OFFLINE_BLOCK_LENGTH;
+	jalv->midi_buf_size = 4096;
+
+	backend->in_buf = (float*)calloc(
+		jalv->block_length * backend->n_in, sizeof(float));
+	backend->out_buf = (float*)calloc(
+		jalv->block_length * backend->n_out, sizeof(float));
+
+	/* Rendering is a batch job, do not wait for commands on stdin */
+	jalv->opts.non_interactive = true;
+
+	return backend;
+}
+
+void
+jalv_backend_close(Jalv* jalv)
+{
+	if (jalv->backend) {
+		for (uint32_t p = 0; p < jalv->num_ports; ++p) {
+			struct Port* const port = &jalv->ports[p];
+			if (port->type == TYPE_AUDIO || port->type == TYPE_CV) {
+				free(port->sys_port);
+				port->sys_port = NULL;
+			}
+		}
+
+		offline_free(jalv->backend);
+		jalv->backend = NULL;
+	}
+}
+
+void
+jalv_backend_activate(Jalv* jalv)
+{
+	JalvBackend* const backend = jalv->backend;
+	if (zix_thread_create(&backend->thread, 1024 * 1024,
+	                      offline_render_func, jalv)) {
+		fprintf(stderr, "error: Failed to launch render thread\n");
+		zix_sem_post(&jalv->done);
+	} else {
+		backend->running = true;
+	}
+}
+
+void
+jalv_backend_deactivate(Jalv* jalv)
+{
+	JalvBackend* const backend = jalv->backend;
+	if (backend && backend->running) {
+		zix_thread_join(backend->thread, NULL);
+		backend->running = false;
+	}
+}
+
+void
+jalv_backend_activate_port(Jalv* jalv, uint32_t port_index)
+{
+	struct Port* const port = &jalv->ports[port_index];
+	switch (port->type) {
+	case TYPE_CONTROL:
+		lilv_instance_connect_port(jalv->instance, port_index, &port->control);
+		break;
+	case TYPE_AUDIO:
+	case TYPE_CV:
+		/* Offline ports are simply buffers for the plugin to use */
+		port->sys_port = calloc(jalv->block_length, sizeof(float));
+		port->buffer   = port->sys_port;
+		lilv_instance_connect_port(jalv->instance, port_index, port->sys_port);
+		break;
+	case TYPE_EVENT:
+		/* Check once here, rather than for every block */
+		port->midi = lilv_port_supports_event(
+			jalv->plugin, port->lilv_port, jalv->nodes.midi_MidiEvent);
+		break;
+	default:
+		break;
+	}
+}
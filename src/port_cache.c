@@ -0,0 +1,674 @@
+/*
+  Copyright 2007-2016 David Robillard <http://drobilla.net>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THIS SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+/**
+   @file port_cache.c Binary cache of plugin port and control descriptions.
+
+   Creating ports and controls queries the plugin data several times for every
+   port.  The result only depends on the plugin data, so it is written to a
+   file in the user's cache directory, and later runs that open the same
+   plugin build ports and controls directly from it.
+
+   The cache records the size and modification time of the plugin bundle and
+   every data file of the plugin, and is ignored if any of them has changed.
+   Values that depend on options or the sample rate are applied when the
+   cache is loaded, so one cache serves every configuration.
+
+   Numbers are written in native byte order, since the cache is local.
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "jalv_internal.h"
+
+#ifndef MAX
+#    define MAX(a, b) (((a) > (b)) ? (a) : (b))
+#endif
+
+#define PORT_CACHE_MAGIC "JALVPORT"
+
+/** Version of the cache format, increase when it changes. */
+#ifdef HAVE_JACK_METADATA
+#    define PORT_CACHE_VERSION 0x103u
+#else
+#    define PORT_CACHE_VERSION 0x102u
+#endif
+
+/** Flags of a cached port. */
+enum {
+	PORT_HIDDEN      = 1u << 0u,  ///< Port is lv2:notOnGUI
+	PORT_SAMPLE_RATE = 1u << 1u,  ///< Range is relative to the sample rate
+	PORT_HAS_CONTROL = 1u << 2u   ///< Port is followed by a control
+};
+
+/** Flags of a cached control. */
+enum {
+	CONTROL_TOGGLE      = 1u << 0u,
+	CONTROL_INTEGER     = 1u << 1u,
+	CONTROL_ENUMERATION = 1u << 2u,
+	CONTROL_LOGARITHMIC = 1u << 3u,
+	CONTROL_WRITABLE    = 1u << 4u,
+	CONTROL_READABLE    = 1u << 5u
+};
+
+/** Kind of a cached node, written before its string value. */
+enum {
+	NODE_NONE   = 0,
+	NODE_URI    = 'U',
+	NODE_INT    = 'I',
+	NODE_FLOAT  = 'F',
+	NODE_BOOL   = 'B',
+	NODE_STRING = 'S'
+};
+
+/** Cursor for reading a cache file loaded into memory. */
+typedef struct {
+	const uint8_t* buf;     ///< File contents
+	size_t         size;    ///< Size of file
+	size_t         offset;  ///< Offset of next read
+	bool           error;   ///< Set if a read went past the end
+} CacheReader;
+
+/** Return the path of the cache file for a plugin. */
+static char*
+port_cache_path(const char* plugin_uri)
+{
+	// FNV-1a hash of the plugin URI, which is also checked when loading
+	uint64_t hash = 14695981039346656037ull;
+	for (const char* c = plugin_uri; *c; ++c) {
+		hash = (hash ^ (uint8_t)*c) * 1099511628211ull;
+	}
+
+	char name[32];
+	snprintf(name, sizeof(name), "ports/%016llx", (unsigned long long)hash);
+	return jalv_cache_path(name);
+}
+
+/** Get the bundle and data files of a plugin as local paths. */
+static char**
+plugin_files(const LilvPlugin* plugin, unsigned* n_files)
+{
+	const LilvNodes* data_uris = lilv_plugin_get_data_uris(plugin);
+	char**           files     = (char**)calloc(lilv_nodes_size(data_uris) + 1,
+	                                            sizeof(char*));
+
+	*n_files = 0;
+	files[(*n_files)++] = lilv_file_uri_parse(
+		lilv_node_as_uri(lilv_plugin_get_bundle_uri(plugin)), NULL);
+	LILV_FOREACH(nodes, d, data_uris) {
+		files[(*n_files)++] = lilv_file_uri_parse(
+			lilv_node_as_uri(lilv_nodes_get(data_uris, d)), NULL);
+	}
+
+	return files;
+}
+
+static void
+free_files(char** files, unsigned n_files)
+{
+	for (unsigned i = 0; i < n_files; ++i) {
+		lilv_free(files[i]);
+	}
+	free(files);
+}
+
+static void
+write_u32(FILE* fd, uint32_t value)
+{
+	fwrite(&value, sizeof(value), 1, fd);
+}
+
+static void
+write_i64(FILE* fd, int64_t value)
+{
+	fwrite(&value, sizeof(value), 1, fd);
+}
+
+static void
+write_f32(FILE* fd, float value)
+{
+	fwrite(&value, sizeof(value), 1, fd);
+}
+
+/** Write a string with its length, and a terminator so it can be used. */
+static void
+write_string(FILE* fd, const char* str)
+{
+	const uint32_t len = str ? (uint32_t)strlen(str) : 0;
+	write_u32(fd, len);
+	fwrite(str ? str : "", 1, len + 1, fd);
+}
+
+/** Write the size and modification time of a file, or zeros if missing. */
+static void
+write_file_stat(FILE* fd, const char* path)
+{
+	struct stat info;
+	if (path && !stat(path, &info)) {
+		write_i64(fd, (int64_t)info.st_size);
+		write_i64(fd, (int64_t)info.st_mtime);
+	} else {
+		write_i64(fd, 0);
+		write_i64(fd, 0);
+	}
+}
+
+/** Write a node, returning non-zero if it can not be cached. */
+static int
+write_node(FILE* fd, const LilvNode* node)
+{
+	char kind = NODE_NONE;
+	if (!node) {
+		fputc(NODE_NONE, fd);
+		return 0;
+	} else if (lilv_node_is_blank(node)) {
+		return 1;  // Blank nodes can not be recreated
+	} else if (lilv_node_is_uri(node)) {
+		kind = NODE_URI;
+	} else if (lilv_node_is_int(node)) {
+		kind = NODE_INT;
+	} else if (lilv_node_is_float(node)) {
+		kind = NODE_FLOAT;
+	} else if (lilv_node_is_bool(node)) {
+		kind = NODE_BOOL;
+	} else {
+		kind = NODE_STRING;
+	}
+
+	fputc(kind, fd);
+	if (kind == NODE_FLOAT) {
+		write_f32(fd, lilv_node_as_float(node));  // Text would depend on locale
+	} else {
+		write_string(fd, lilv_node_as_string(node));
+	}
+	return 0;
+}
+
+static const void*
+read_bytes(CacheReader* reader, size_t size)
+{
+	if (reader->error || reader->size - reader->offset < size) {
+		reader->error = true;
+		return NULL;
+	}
+
+	const void* bytes = reader->buf + reader->offset;
+	reader->offset += size;
+	return bytes;
+}
+
+static uint32_t
+read_u32(CacheReader* reader)
+{
+	uint32_t    value = 0;
+	const void* bytes = read_bytes(reader, sizeof(value));
+	if (bytes) {
+		memcpy(&value, bytes, sizeof(value));
+	}
+	return value;
+}
+
+static int64_t
+read_i64(CacheReader* reader)
+{
+	int64_t     value = 0;
+	const void* bytes = read_bytes(reader, sizeof(value));
+	if (bytes) {
+		memcpy(&value, bytes, sizeof(value));
+	}
+	return value;
+}
+
+static float
+read_f32(CacheReader* reader)
+{
+	float       value = 0.0f;
+	const void* bytes = read_bytes(reader, sizeof(value));
+	if (bytes) {
+		memcpy(&value, bytes, sizeof(value));
+	}
+	return value;
+}
+
+static uint8_t
+read_u8(CacheReader* reader)
+{
+	const uint8_t* byte = (const uint8_t*)read_bytes(reader, 1);
+	return byte ? *byte : 0;
+}
+
+/** Read a string, returning a pointer into the file, or NULL on error. */
+static const char*
+read_string(CacheReader* reader)
+{
+	const uint32_t len = read_u32(reader);
+	const char*    str = (const char*)read_bytes(
+		reader, reader->error ? 0 : (size_t)len + 1);
+	if (str && str[len]) {
+		reader->error = true;
+	}
+	return reader->error ? NULL : str;
+}
+
+static LilvNode*
+read_node(CacheReader* reader, LilvWorld* world)
+{
+	const uint8_t kind = read_u8(reader);
+	if (kind == NODE_NONE) {
+		return NULL;
+	}
+
+	if (kind == NODE_FLOAT) {
+		const float value = read_f32(reader);
+		return reader->error ? NULL : lilv_new_float(world, value);
+	}
+
+	const char* str = read_string(reader);
+	if (!str) {
+		return NULL;
+	}
+
+	switch (kind) {
+	case NODE_URI:
+		return lilv_new_uri(world, str);
+	case NODE_INT:
+		return lilv_new_int(world, atoi(str));
+	case NODE_BOOL:
+		return lilv_new_bool(world, !strcmp(str, "true"));
+	case NODE_STRING:
+		return lilv_new_string(world, str);
+	default:
+		reader->error = true;
+		return NULL;
+	}
+}
+
+/** Return true iff the plugin files have not changed since they were cached. */
+static bool
+read_files_current(CacheReader* reader, const LilvPlugin* plugin)
+{
+	unsigned     n_files = 0;
+	char** const files   = plugin_files(plugin, &n_files);
+	bool         current = read_u32(reader) == n_files;
+
+	for (unsigned i = 0; current && i < n_files; ++i) {
+		const char*   path  = read_string(reader);
+		const int64_t size  = read_i64(reader);
+		const int64_t mtime = read_i64(reader);
+		struct stat   info;
+
+		current = path && files[i] && !strcmp(path, files[i]) &&
+		          !stat(path, &info) &&
+		          (int64_t)info.st_size == size &&
+		          (int64_t)info.st_mtime == mtime;
+	}
+
+	free_files(files, n_files);
+	return current && !reader->error;
+}
+
+static void
+free_control(ControlID* control)
+{
+	for (size_t i = 0; i < control->n_points; ++i) {
+		free(control->points[i].label);
+	}
+	free(control->points);
+	lilv_node_free(control->node);
+	lilv_node_free(control->symbol);
+	lilv_node_free(control->label);
+	lilv_node_free(control->group);
+	lilv_node_free(control->min);
+	lilv_node_free(control->max);
+	lilv_node_free(control->def);
+	free(control);
+}
+
+/** Read a control, which is not added to the controls yet. */
+static ControlID*
+read_control(Jalv* jalv, CacheReader* reader, uint32_t port_flags)
+{
+	ControlID* id = (ControlID*)calloc(1, sizeof(ControlID));
+	id->jalv  = jalv;
+	id->type  = read_u8(reader) ? PROPERTY : PORT;
+	id->index = read_u32(reader);
+
+	const uint32_t flags = read_u32(reader);
+	id->is_toggle      = flags & CONTROL_TOGGLE;
+	id->is_integer     = flags & CONTROL_INTEGER;
+	id->is_enumeration = flags & CONTROL_ENUMERATION;
+	id->is_logarithmic = flags & CONTROL_LOGARITHMIC;
+	id->is_writable    = flags & CONTROL_WRITABLE;
+	id->is_readable    = flags & CONTROL_READABLE;
+
+	id->node   = read_node(reader, jalv->world);
+	id->symbol = read_node(reader, jalv->world);
+	id->label  = read_node(reader, jalv->world);
+	id->group  = read_node(reader, jalv->world);
+	id->min    = read_node(reader, jalv->world);
+	id->max    = read_node(reader, jalv->world);
+	id->def    = read_node(reader, jalv->world);
+
+	const char* value_type = read_string(reader);
+	if (id->type == PORT) {
+		id->value_type = jalv->forge.Float;
+	} else if (value_type && id->node) {
+		id->value_type = jalv->map.map(jalv, value_type);
+		id->property   = jalv->map.map(jalv, lilv_node_as_uri(id->node));
+	}
+
+	const uint32_t n_points = read_u32(reader);
+	if (n_points && n_points <= reader->size / sizeof(float)) {
+		id->points = (ScalePoint*)calloc(n_points, sizeof(ScalePoint));
+		for (uint32_t i = 0; i < n_points && !reader->error; ++i) {
+			const float value = read_f32(reader);
+			const char* label = read_string(reader);
+			if (label) {
+				id->points[id->n_points].value   = value;
+				id->points[id->n_points++].label = strdup(label);
+			}
+		}
+	} else if (n_points) {
+		reader->error = true;
+	}
+
+	if (port_flags & PORT_SAMPLE_RATE) {
+		scale_sample_rate_range(jalv, id);
+	}
+
+	if (reader->error) {
+		free_control(id);
+		return NULL;
+	}
+
+	return id;
+}
+
+int
+jalv_load_port_cache(Jalv* jalv)
+{
+	const char* const plugin_uri =
+		lilv_node_as_uri(lilv_plugin_get_uri(jalv->plugin));
+
+	char* const path = port_cache_path(plugin_uri);
+	FILE* const fd   = path ? fopen(path, "rb") : NULL;
+	free(path);
+	if (!fd) {
+		return 1;
+	}
+
+	// Load the whole file, it is small and read only once
+	fseek(fd, 0, SEEK_END);
+	const long size = ftell(fd);
+	fseek(fd, 0, SEEK_SET);
+	uint8_t* const buf = (uint8_t*)malloc(size > 0 ? (size_t)size : 1);
+	CacheReader    reader = { buf, 0, 0, false };
+	if (size > 0) {
+		reader.size = fread(buf, 1, (size_t)size, fd);
+	}
+	fclose(fd);
+
+	const char* magic     = (const char*)read_bytes(&reader, 8);
+	const bool  valid     = magic && !memcmp(magic, PORT_CACHE_MAGIC, 8) &&
+	                        read_u32(&reader) == PORT_CACHE_VERSION;
+	const char* uri       = valid ? read_string(&reader) : NULL;
+	const bool  current   = uri && !strcmp(uri, plugin_uri) &&
+	                        read_files_current(&reader, jalv->plugin);
+	const uint32_t n_ports = current ? read_u32(&reader) : 0;
+	if (!current ||
+	    n_ports != lilv_plugin_get_num_ports(jalv->plugin) ||
+	    reader.error) {
+		free(buf);
+		return 1;
+	}
+
+	// Read ports and port controls
+	struct Port* const ports      = (struct Port*)calloc(n_ports,
+	                                                     sizeof(struct Port));
+	Controls           controls   = { 0, NULL };
+	const uint32_t     control_in = read_u32(&reader);
+	size_t             buf_size   = 0;
+	for (uint32_t i = 0; i < n_ports && !reader.error; ++i) {
+		struct Port* const port = &ports[i];
+
+		port->lilv_port = lilv_plugin_get_port_by_index(jalv->plugin, i);
+		port->index     = i;
+		port->type      = (enum PortType)read_u8(&reader);
+		port->flow      = (enum PortFlow)read_u8(&reader);
+		port->control   = read_f32(&reader);
+		port->buf_size  = read_u32(&reader);
+		buf_size        = MAX(buf_size, port->buf_size);
+
+		const uint32_t flags = read_u32(&reader);
+		if (flags & PORT_HAS_CONTROL) {
+			ControlID* const control = read_control(jalv, &reader, flags);
+			if (!control) {
+				reader.error = true;
+			} else if ((flags & PORT_HIDDEN) && !jalv->opts.show_hidden) {
+				free_control(control);
+			} else {
+				add_control(&controls, control);
+			}
+		}
+	}
+
+	// Read property controls
+	const uint32_t n_properties = read_u32(&reader);
+	for (uint32_t i = 0; i < n_properties && !reader.error; ++i) {
+		ControlID* const control = read_control(jalv, &reader, 0);
+		if (control) {
+			add_control(&controls, control);
+		}
+	}
+
+	free(buf);
+	if (reader.error) {
+		for (size_t i = 0; i < controls.n_controls; ++i) {
+			free_control(controls.controls[i]);
+		}
+		free(controls.controls);
+		free(ports);
+		return 1;
+	}
+
+	jalv->num_ports  = n_ports;
+	jalv->ports      = ports;
+	jalv->control_in = control_in;
+	for (size_t i = 0; i < controls.n_controls; ++i) {
+		add_control(&jalv->controls, controls.controls[i]);
+	}
+	free(controls.controls);
+
+	if (buf_size) {
+		jalv->opts.buffer_size = MAX(jalv->opts.buffer_size,
+		                             buf_size * N_BUFFER_CYCLES);
+	}
+
+	return 0;
+}
+
+/** Write a control, returning non-zero if it can not be cached. */
+static int
+write_control(Jalv* jalv, FILE* fd, const ControlID* control)
+{
+	const uint32_t flags =
+		(control->is_toggle      ? CONTROL_TOGGLE      : 0u) |
+		(control->is_integer     ? CONTROL_INTEGER     : 0u) |
+		(control->is_enumeration ? CONTROL_ENUMERATION : 0u) |
+		(control->is_logarithmic ? CONTROL_LOGARITHMIC : 0u) |
+		(control->is_writable    ? CONTROL_WRITABLE    : 0u) |
+		(control->is_readable    ? CONTROL_READABLE    : 0u);
+
+	fputc(control->type == PROPERTY, fd);
+	write_u32(fd, control->index);
+	write_u32(fd, flags);
+
+	int st = 0;
+	st |= write_node(fd, control->node);
+	st |= write_node(fd, control->symbol);
+	st |= write_node(fd, control->label);
+	st |= write_node(fd, control->group);
+	st |= write_node(fd, control->min);
+	st |= write_node(fd, control->max);
+	st |= write_node(fd, control->def);
+
+	write_string(fd, control->type == PROPERTY
+	             ? jalv->unmap.unmap(jalv->unmap.handle, control->value_type)
+	             : NULL);
+
+	write_u32(fd, (uint32_t)control->n_points);
+	for (size_t i = 0; i < control->n_points; ++i) {
+		write_f32(fd, control->points[i].value);
+		write_string(fd, control->points[i].label);
+	}
+
+	return st;
+}
+
+/** Return the control created for a port, or NULL if it is hidden. */
+static const ControlID*
+find_port_control(const Jalv* jalv, uint32_t index)
+{
+	for (size_t i = 0; i < jalv->controls.n_controls; ++i) {
+		const ControlID* const control = jalv->controls.controls[i];
+		if (control->type == PORT && control->index == index) {
+			return control;
+		}
+	}
+	return NULL;
+}
+
+/** Write a port and its control, returning non-zero if it can not be cached. */
+static int
+write_port(Jalv* jalv, FILE* fd, const struct Port* port)
+{
+	const LilvPlugin* plugin = jalv->plugin;
+	const LilvPort*   lport  = port->lilv_port;
+	const bool        is_control = port->type == TYPE_CONTROL;
+
+	uint32_t flags = is_control ? PORT_HAS_CONTROL : 0u;
+	if (is_control &&
+	    lilv_port_has_property(plugin, lport, jalv->nodes.pprops_notOnGUI)) {
+		flags |= PORT_HIDDEN;
+	}
+	if (is_control &&
+	    lilv_port_has_property(plugin, lport, jalv->nodes.lv2_sampleRate)) {
+		flags |= PORT_SAMPLE_RATE;
+	}
+
+	fputc(port->type, fd);
+	fputc(port->flow, fd);
+	write_f32(fd, port->control);
+	write_u32(fd, (uint32_t)port->buf_size);
+	write_u32(fd, flags);
+	if (!is_control) {
+		return 0;
+	}
+
+	// Create a temporary control for hidden ports
+	const ControlID* control = find_port_control(jalv, port->index);
+	ControlID*       owned   = control ? NULL
+		: new_port_control(jalv, port->index);
+
+	// Write the range unscaled, since the sample rate may differ when loaded
+	int st = 0;
+	if (flags & PORT_SAMPLE_RATE) {
+		ControlID unscaled = *(control ? control : owned);
+		lilv_port_get_range(
+			plugin, lport, &unscaled.def, &unscaled.min, &unscaled.max);
+		st = write_control(jalv, fd, &unscaled);
+		lilv_node_free(unscaled.def);
+		lilv_node_free(unscaled.min);
+		lilv_node_free(unscaled.max);
+	} else {
+		st = write_control(jalv, fd, control ? control : owned);
+	}
+
+	if (owned) {
+		free_control(owned);
+	}
+
+	return st;
+}
+
+void
+jalv_save_port_cache(Jalv* jalv)
+{
+	const char* const plugin_uri =
+		lilv_node_as_uri(lilv_plugin_get_uri(jalv->plugin));
+
+	char* const path = port_cache_path(plugin_uri);
+	if (!path) {
+		return;
+	}
+
+	jalv_create_parents(path);
+	char* const tmp_path = jalv_temp_path(path);
+	FILE* const fd       = fopen(tmp_path, "wb");
+	if (!fd) {
+		free(tmp_path);
+		free(path);
+		return;
+	}
+
+	fwrite(PORT_CACHE_MAGIC, 1, 8, fd);
+	write_u32(fd, PORT_CACHE_VERSION);
+	write_string(fd, plugin_uri);
+
+	unsigned     n_files = 0;
+	char** const files   = plugin_files(jalv->plugin, &n_files);
+	write_u32(fd, n_files);
+	for (unsigned i = 0; i < n_files; ++i) {
+		write_string(fd, files[i]);
+		write_file_stat(fd, files[i]);
+	}
+	free_files(files, n_files);
+
+	int st = 0;
+	write_u32(fd, jalv->num_ports);
+	write_u32(fd, jalv->control_in);
+	for (uint32_t i = 0; i < jalv->num_ports; ++i) {
+		st |= write_port(jalv, fd, &jalv->ports[i]);
+	}
+
+	uint32_t n_properties = 0;
+	for (size_t i = 0; i < jalv->controls.n_controls; ++i) {
+		n_properties += jalv->controls.controls[i]->type == PROPERTY;
+	}
+	write_u32(fd, n_properties);
+	for (size_t i = 0; i < jalv->controls.n_controls; ++i) {
+		if (jalv->controls.controls[i]->type == PROPERTY) {
+			st |= write_control(jalv, fd, jalv->controls.controls[i]);
+		}
+	}
+
+	st |= ferror(fd);
+	st |= fclose(fd);
+#ifdef _WIN32
+	remove(path);
+#endif
+	if (st || rename(tmp_path, path)) {
+		remove(tmp_path);
+	}
+
+	free(tmp_path);
+	free(path);
+}
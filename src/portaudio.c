@@ -15,12 +15,18 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include <portaudio.h>
 
 #include "jalv_internal.h"
 #include "worker.h"
 
+/* Frames per callback.  This is fixed, so CV ports, which have no stream
+   channel, can have buffers of the same size. */
+#define PA_BLOCK_LENGTH 512
+
 struct JalvBackend {
 	PaStream* stream;
 };
@@ -33,71 +39,70 @@ pa_process_cb(const void*                     inputs,
               PaStreamCallbackFlags           flags,
               void*                           handle)
 {
-	Jalv* jalv = (Jalv*)handle;
+	Jalv* const                  jalv = (Jalv*)handle;
+	const JalvProcessPlan* const plan = &jalv->plan;
 
-	/* Prepare port buffers */
+	/* Connect audio ports to stream channels, and CV ports to their own
+	   buffers since the stream only has channels for audio ports */
 	uint32_t in_index  = 0;
 	uint32_t out_index = 0;
-	for (uint32_t i = 0; i < jalv->num_ports; ++i) {
-		struct Port* port = &jalv->ports[i];
+	for (uint32_t i = 0; i < plan->n_audio_in; ++i) {
+		struct Port* const port = &jalv->ports[plan->audio_in[i]];
 		if (port->type == TYPE_AUDIO) {
-			if (port->flow == FLOW_INPUT) {
-				lilv_instance_connect_port(jalv->instance, i, ((float**)inputs)[in_index++]);
-			} else if (port->flow == FLOW_OUTPUT) {
-				lilv_instance_connect_port(jalv->instance, i, ((float**)outputs)[out_index++]);
-			}
-		} else if (port->type == TYPE_EVENT && port->flow == FLOW_INPUT) {
-			lv2_evbuf_reset(port->evbuf, true);
-
-			if (jalv->request_update) {
-				/* Plugin state has changed, request an update */
-				const LV2_Atom_Object get = {
-					{ sizeof(LV2_Atom_Object_Body), jalv->urids.atom_Object },
-					{ 0, jalv->urids.patch_Get } };
-				LV2_Evbuf_Iterator iter = lv2_evbuf_begin(port->evbuf);
-				lv2_evbuf_write(&iter, 0, 0,
-				                get.atom.type, get.atom.size,
-				                (const uint8_t*)LV2_ATOM_BODY(&get));
-			}
-		} else if (port->type == TYPE_EVENT) {
-			/* Clear event output for plugin to write to */
-			lv2_evbuf_reset(port->evbuf, false);
+			jalv_connect_port(
+				jalv, plan->audio_in[i], ((float**)inputs)[in_index++]);
+		} else {
+			memset(port->sys_port, 0, nframes * sizeof(float));
+			jalv_connect_port(jalv, plan->audio_in[i], port->sys_port);
+		}
+	}
+	for (uint32_t i = 0; i < plan->n_audio_out; ++i) {
+		struct Port* const port = &jalv->ports[plan->audio_out[i]];
+		jalv_connect_port(jalv, plan->audio_out[i],
+		                  (port->type == TYPE_AUDIO)
+		                  ? ((float**)outputs)[out_index++]
+		                  : port->sys_port);
+	}
+
+	/* Prepare event buffers */
+	for (uint32_t i = 0; i < plan->n_event_in; ++i) {
+		struct Port* const port = &jalv->ports[plan->event_in[i]];
+		lv2_evbuf_reset(port->evbuf, true);
+
+		if (jalv->request_update) {
+			/* Plugin state has changed, request an update */
+			const LV2_Atom_Object get = {
+				{ sizeof(LV2_Atom_Object_Body), jalv->urids.atom_Object },
+				{ 0, jalv->urids.patch_Get } };
+			LV2_Evbuf_Iterator iter = lv2_evbuf_begin(port->evbuf);
+			lv2_evbuf_write(&iter, 0, 0,
+			                get.atom.type, get.atom.size,
+			                (const uint8_t*)LV2_ATOM_BODY(&get));
 		}
 	}
+	for (uint32_t i = 0; i < plan->n_event_out; ++i) {
+		/* Clear event output for plugin to write to */
+		lv2_evbuf_reset(jalv->ports[plan->event_out[i]].evbuf, false);
+	}
 	jalv->request_update = false;
 
 	/* Run plugin for this cycle */
-	const bool send_ui_updates = jalv_run(jalv, nframes);
+	jalv_run(jalv, nframes);
 
 	/* Deliver UI events */
-	for (uint32_t p = 0; p < jalv->num_ports; ++p) {
+	for (uint32_t o = 0; jalv->has_ui && o < plan->n_event_out; ++o) {
+		const uint32_t     p    = plan->event_out[o];
 		struct Port* const port = &jalv->ports[p];
-		if (port->flow == FLOW_OUTPUT && port->type == TYPE_EVENT) {
-			for (LV2_Evbuf_Iterator i = lv2_evbuf_begin(port->evbuf);
-			     lv2_evbuf_is_valid(i);
-			     i = lv2_evbuf_next(i)) {
-				// Get event from LV2 buffer
-				uint32_t frames, subframes, type, size;
-				uint8_t* body;
-				lv2_evbuf_get(i, &frames, &subframes, &type, &size, &body);
-
-				if (jalv->has_ui) {
-					// Forward event to UI
-					jalv_send_to_ui(jalv, p, type, size, body);
-				}
-			}
-		} else if (send_ui_updates &&
-		           port->flow == FLOW_OUTPUT && port->type == TYPE_CONTROL) {
-			char buf[sizeof(ControlChange) + sizeof(float)];
-			ControlChange* ev = (ControlChange*)buf;
-			ev->index    = p;
-			ev->protocol = 0;
-			ev->size     = sizeof(float);
-			*(float*)ev->body = port->control;
-			if (zix_ring_write(jalv->plugin_events, buf, sizeof(buf))
-			    < sizeof(buf)) {
-				fprintf(stderr, "Plugin => UI buffer overflow!\n");
-			}
+		for (LV2_Evbuf_Iterator i = lv2_evbuf_begin(port->evbuf);
+		     lv2_evbuf_is_valid(i);
+		     i = lv2_evbuf_next(i)) {
+			// Get event from LV2 buffer
+			uint32_t frames, subframes, type, size;
+			uint8_t* body;
+			lv2_evbuf_get(i, &frames, &subframes, &type, &size, &body);
+
+			// Forward event to UI
+			jalv_send_to_ui(jalv, p, type, size, body);
 		}
 	}
 
@@ -120,6 +125,12 @@ jalv_backend_init(Jalv* jalv)
 	PaStream*          stream = NULL;
 	PaError            st     = paNoError;
 
+	if (jalv->opts.instances) {
+		fprintf(stderr, "warning: Additional instances require JACK\n");
+		free(jalv->opts.instances);
+		jalv->opts.instances = NULL;
+	}
+
 	if ((st = Pa_Initialize())) {
 		return pa_error("Failed to initialize audio system", st);
 	}
@@ -163,7 +174,7 @@ jalv_backend_init(Jalv* jalv)
 		     inputParameters.channelCount ? &inputParameters : NULL,
 		     outputParameters.channelCount ? &outputParameters : NULL,
 		     in_dev->defaultSampleRate,
-		     paFramesPerBufferUnspecified,
+		     PA_BLOCK_LENGTH,
 		     0,
 		     pa_process_cb,
 		     jalv))) {
@@ -172,7 +183,7 @@ jalv_backend_init(Jalv* jalv)
 
 	// Set audio parameters
 	jalv->sample_rate   = in_dev->defaultSampleRate;
-	// jalv->block_length  = FIXME
+	jalv->block_length  = PA_BLOCK_LENGTH;
 	jalv->midi_buf_size = 4096;
 
 	// Allocate and return opaque backend
@@ -184,6 +195,14 @@ jalv_backend_init(Jalv* jalv)
 void
 jalv_backend_close(Jalv* jalv)
 {
+	for (uint32_t p = 0; p < jalv->num_ports; ++p) {
+		struct Port* const port = &jalv->ports[p];
+		if (port->type == TYPE_CV) {
+			free(port->sys_port);
+			port->sys_port = NULL;
+		}
+	}
+
 	Pa_Terminate();
 	free(jalv->backend);
 	jalv->backend = NULL;
@@ -217,6 +236,11 @@ jalv_backend_activate_port(Jalv* jalv, uint32_t port_index)
 	case TYPE_CONTROL:
 		lilv_instance_connect_port(jalv->instance, port_index, &port->control);
 		break;
+	case TYPE_CV:
+		/* CV ports have no stream channel, so they get their own buffer */
+		port->sys_port = calloc(jalv->block_length, sizeof(float));
+		lilv_instance_connect_port(jalv->instance, port_index, port->sys_port);
+		break;
 	default:
 		break;
 	}
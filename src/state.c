@@ -18,6 +18,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <errno.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -83,74 +84,162 @@ jalv_save(Jalv* jalv, const char* dir)
 	jalv->save_dir = NULL;
 }
 
-int
-jalv_load_presets(Jalv* jalv, PresetSink sink, void* data)
+/** Free the preset index, so it is rebuilt when next needed. */
+static void
+jalv_free_presets(Jalv* jalv)
 {
+	for (uint32_t i = 0; i < jalv->n_presets; ++i) {
+		lilv_node_free(jalv->presets[i].uri);
+		lilv_node_free(jalv->presets[i].label);
+	}
+	free(jalv->presets);
+	jalv->presets      = NULL;
+	jalv->n_presets    = 0;
+	jalv->have_presets = false;
+}
+
+/**
+   Index the presets of the plugin, if necessary.
+
+   Only presets without a label in the already loaded data, usually their
+   bundle manifest, are loaded to find one.
+*/
+static void
+jalv_index_presets(Jalv* jalv)
+{
+	if (jalv->have_presets) {
+		return;
+	}
+
 	LilvNodes* presets = lilv_plugin_get_related(jalv->plugin,
 	                                             jalv->nodes.pset_Preset);
+
+	jalv_free_presets(jalv);
+	jalv->presets = (JalvPreset*)calloc(lilv_nodes_size(presets) + 1,
+	                                    sizeof(JalvPreset));
 	LILV_FOREACH(nodes, i, presets) {
 		const LilvNode* preset = lilv_nodes_get(presets, i);
-		lilv_world_load_resource(jalv->world, preset);
-		if (!sink) {
-			continue;
+		LilvNode*       label  = lilv_world_get(
+			jalv->world, preset, jalv->nodes.rdfs_label, NULL);
+
+		bool loaded = false;
+		if (!label) {
+			lilv_world_load_resource(jalv->world, preset);
+			loaded = true;
+			label  = lilv_world_get(
+				jalv->world, preset, jalv->nodes.rdfs_label, NULL);
 		}
 
-		LilvNodes* labels = lilv_world_find_nodes(
-			jalv->world, preset, jalv->nodes.rdfs_label, NULL);
-		if (labels) {
-			const LilvNode* label = lilv_nodes_get_first(labels);
-			sink(jalv, preset, label, data);
-			lilv_nodes_free(labels);
-		} else {
+		if (!label) {
 			fprintf(stderr, "Preset <%s> has no rdfs:label\n",
-			        lilv_node_as_string(lilv_nodes_get(presets, i)));
+			        lilv_node_as_string(preset));
+			continue;
 		}
+
+		JalvPreset* const record = &jalv->presets[jalv->n_presets++];
+		record->uri    = lilv_node_duplicate(preset);
+		record->label  = label;
+		record->loaded = loaded;
 	}
 	lilv_nodes_free(presets);
 
+	jalv->have_presets = true;
+}
+
+int
+jalv_load_presets(Jalv* jalv, PresetSink sink, void* data)
+{
+	jalv_index_presets(jalv);
+	for (uint32_t i = 0; sink && i < jalv->n_presets; ++i) {
+		sink(jalv, jalv->presets[i].uri, jalv->presets[i].label, data);
+	}
+
 	return 0;
 }
 
 int
 jalv_unload_presets(Jalv* jalv)
 {
-	LilvNodes* presets = lilv_plugin_get_related(jalv->plugin,
-	                                             jalv->nodes.pset_Preset);
-	LILV_FOREACH(nodes, i, presets) {
-		const LilvNode* preset = lilv_nodes_get(presets, i);
-		lilv_world_unload_resource(jalv->world, preset);
+	for (uint32_t i = 0; i < jalv->n_presets; ++i) {
+		if (jalv->presets[i].loaded) {
+			lilv_world_unload_resource(jalv->world, jalv->presets[i].uri);
+		}
 	}
-	lilv_nodes_free(presets);
+	jalv_free_presets(jalv);
 
 	return 0;
 }
 
-static void
-set_port_value(const char*         port_symbol,
-               void*               user_data,
-               const void*         value,
-               ZIX_UNUSED uint32_t size,
-               uint32_t            type)
+LilvState*
+jalv_load_preset(Jalv* jalv, const LilvNode* preset)
+{
+	jalv_index_presets(jalv);
+
+	JalvPreset* record = NULL;
+	for (uint32_t i = 0; i < jalv->n_presets; ++i) {
+		if (lilv_node_equals(jalv->presets[i].uri, preset)) {
+			record = &jalv->presets[i];
+			break;
+		}
+	}
+
+	if (!record || !record->loaded) {
+		lilv_world_load_resource(jalv->world, preset);
+		if (record) {
+			record->loaded = true;
+		}
+	}
+
+	return lilv_state_new_from_world(jalv->world, &jalv->map, preset);
+}
+
+/**
+   Get the port and float value of a port value from a state.
+
+   @return The port, or NULL on error, in which case `fvalue` is not set.
+*/
+static struct Port*
+get_state_port_value(Jalv*       jalv,
+                     const char* port_symbol,
+                     const void* value,
+                     uint32_t    type,
+                     float*      fvalue)
 {
-	Jalv*        jalv = (Jalv*)user_data;
 	struct Port* port = jalv_port_by_symbol(jalv, port_symbol);
 	if (!port) {
 		fprintf(stderr, "error: Preset port `%s' is missing\n", port_symbol);
-		return;
+		return NULL;
 	}
 
-	float fvalue;
 	if (type == jalv->forge.Float) {
-		fvalue = *(const float*)value;
+		*fvalue = *(const float*)value;
 	} else if (type == jalv->forge.Double) {
-		fvalue = *(const double*)value;
+		*fvalue = *(const double*)value;
 	} else if (type == jalv->forge.Int) {
-		fvalue = *(const int32_t*)value;
+		*fvalue = *(const int32_t*)value;
 	} else if (type == jalv->forge.Long) {
-		fvalue = *(const int64_t*)value;
+		*fvalue = *(const int64_t*)value;
 	} else {
 		fprintf(stderr, "error: Preset `%s' value has bad type <%s>\n",
 		        port_symbol, jalv->unmap.unmap(jalv->unmap.handle, type));
+		return NULL;
+	}
+
+	return port;
+}
+
+static void
+set_port_value(const char*         port_symbol,
+               void*               user_data,
+               const void*         value,
+               ZIX_UNUSED uint32_t size,
+               uint32_t            type)
+{
+	Jalv*        jalv = (Jalv*)user_data;
+	float        fvalue;
+	struct Port* port = get_state_port_value(
+		jalv, port_symbol, value, type, &fvalue);
+	if (!port) {
 		return;
 	}
 
@@ -164,26 +253,219 @@ set_port_value(const char*         port_symbol,
 
 	if (jalv->has_ui) {
 		// Update UI
-		char buf[sizeof(ControlChange) + sizeof(fvalue)];
-		ControlChange* ev = (ControlChange*)buf;
-		ev->index    = port->index;
-		ev->protocol = 0;
-		ev->size     = sizeof(fvalue);
-		*(float*)ev->body = fvalue;
-		zix_ring_write(jalv->plugin_events, buf, sizeof(buf));
+		jalv_publish_control(jalv, port, fvalue);
 	}
 }
 
+/** Set a port value of the new instance of a crossfade. */
+static void
+set_crossfade_port_value(const char*         port_symbol,
+                         void*               user_data,
+                         const void*         value,
+                         ZIX_UNUSED uint32_t size,
+                         uint32_t            type)
+{
+	Jalv*        jalv = (Jalv*)user_data;
+	float        fvalue;
+	struct Port* port = get_state_port_value(
+		jalv, port_symbol, value, type, &fvalue);
+	if (port) {
+		jalv->crossfade.controls[port->index] = fvalue;
+		if (jalv->has_ui) {
+			jalv_publish_control(jalv, port, fvalue);
+		}
+	}
+}
+
+/**
+   Return true iff state can be applied by crossfading to a new instance.
+
+   The new instance replaces the running one, so this is not possible if
+   anything holds on to the running instance.  Workers call the instance they
+   were created for, and a UI may have its handle via instance-access.
+*/
+static bool
+jalv_can_crossfade(Jalv* jalv)
+{
+	if (!jalv->opts.crossfade || jalv->worker.iface) {
+		return false;
+	}
+
+#ifdef HAVE_SUIL
+	if (jalv->ui_instance) {
+		LilvWorld* const world   = jalv->world;
+		LilvNode*        feature = lilv_new_uri(
+			world, "http://lv2plug.in/ns/ext/instance-access");
+		LilvNode* required = lilv_new_uri(world, LV2_CORE__requiredFeature);
+		LilvNode* optional = lilv_new_uri(world, LV2_CORE__optionalFeature);
+
+		const LilvNode* ui  = lilv_ui_get_uri(jalv->ui);
+		const bool      ret = (!lilv_world_ask(world, ui, required, feature) &&
+		                       !lilv_world_ask(world, ui, optional, feature));
+
+		lilv_node_free(optional);
+		lilv_node_free(required);
+		lilv_node_free(feature);
+		return ret;
+	}
+#endif
+
+	return true;
+}
+
+static void
+jalv_free_crossfade(Jalv* jalv)
+{
+	JalvCrossfade* const xfade = &jalv->crossfade;
+	for (uint32_t i = 0; xfade->events && i < jalv->plan.n_event_out; ++i) {
+		lv2_evbuf_free(xfade->events[i]);
+	}
+
+	free(xfade->events);
+	free(xfade->controls);
+	free(xfade->audio);
+	xfade->events   = NULL;
+	xfade->controls = NULL;
+	xfade->audio    = NULL;
+	xfade->instance = NULL;
+	zix_atomic_store(&xfade->state, JALV_FADE_IDLE);
+}
+
+/** Time without any frames being run before a crossfade is abandoned. */
+#define JALV_FADE_TIMEOUT_US 250000u
+
+/** Sleep for a millisecond while waiting for the process thread. */
+static void
+jalv_fade_sleep(void)
+{
+#ifdef _WIN32
+	Sleep(1);
+#else
+	const struct timespec delay = { 0, 1000000 };
+	nanosleep(&delay, NULL);
+#endif
+}
+
+/**
+   Wait until the process thread has swapped in the new instance.
+
+   The process thread may stop running the plugin, for example when exiting
+   or if the audio system stops calling it, so this gives up if no frames have
+   been run for a while.  The fade is then cancelled under its lock, after
+   which the process thread does not use it again.
+
+   @return True iff the new instance was swapped in.
+*/
+static bool
+jalv_wait_for_crossfade(Jalv* jalv)
+{
+	JalvCrossfade* const xfade      = &jalv->crossfade;
+	uint64_t             frame_time = jalv->frame_time;
+	uint64_t             last_run   = jalv_time_us();
+	while (zix_atomic_load(&xfade->state) != JALV_FADE_DONE) {
+		const uint64_t now = jalv_time_us();
+		if (jalv->frame_time != frame_time) {
+			frame_time = jalv->frame_time;
+			last_run   = now;
+		} else if (jalv->exit || now - last_run > JALV_FADE_TIMEOUT_US) {
+			if (!zix_atomic_add(&xfade->lock, 1)) {
+				const bool done =
+					zix_atomic_load(&xfade->state) == JALV_FADE_DONE;
+				zix_atomic_store(&xfade->state, JALV_FADE_IDLE);
+				zix_atomic_sub(&xfade->lock, 1);
+				return done;
+			}
+			zix_atomic_sub(&xfade->lock, 1);
+		}
+		jalv_fade_sleep();
+	}
+	return true;
+}
+
+/**
+   Apply state by restoring it into a new instance and crossfading to it.
+
+   The running instance keeps running until the process thread has faded to
+   the new one, so there is no dropout even if restore() is not thread-safe.
+
+   If the process thread stopped running the plugin before the swap, the
+   state is not applied, so the caller can restore it while paused instead.
+
+   @return Zero on success, or non-zero if the state was not applied.
+*/
+static int
+jalv_crossfade_state(Jalv*                     jalv,
+                     LilvState*                state,
+                     const LV2_Feature* const* state_features)
+{
+	JalvCrossfade* const         xfade = &jalv->crossfade;
+	const JalvProcessPlan* const plan  = &jalv->plan;
+
+	LilvInstance* const instance = lilv_plugin_instantiate(
+		jalv->plugin, jalv->sample_rate, jalv->feature_list);
+	if (!instance) {
+		fprintf(stderr, "warning: Failed to instantiate plugin to crossfade\n");
+		return 1;
+	}
+
+	xfade->capacity = jalv->block_length;
+	xfade->audio    = (float*)calloc(
+		(size_t)plan->n_audio_out * xfade->capacity, sizeof(float));
+	xfade->controls = (float*)calloc(jalv->num_ports, sizeof(float));
+	xfade->events   = (LV2_Evbuf**)calloc(plan->n_event_out,
+	                                      sizeof(LV2_Evbuf*));
+	for (uint32_t i = 0; i < plan->n_event_out; ++i) {
+		const struct Port* const port = &jalv->ports[plan->event_out[i]];
+		xfade->events[i] = lv2_evbuf_new(
+			(port->buf_size > 0) ? port->buf_size : jalv->midi_buf_size,
+			jalv->map.map(jalv->map.handle,
+			              lilv_node_as_string(jalv->nodes.atom_Chunk)),
+			jalv->map.map(jalv->map.handle,
+			              lilv_node_as_string(jalv->nodes.atom_Sequence)));
+	}
+
+	/* Connect control ports to the new values, the rest are done per cycle */
+	for (uint32_t p = 0; p < jalv->num_ports; ++p) {
+		const struct Port* const port = &jalv->ports[p];
+		xfade->controls[p] = port->control;
+		lilv_instance_connect_port(
+			instance, p,
+			(port->type == TYPE_CONTROL) ? &xfade->controls[p] : NULL);
+	}
+
+	lilv_state_restore(
+		state, instance, set_crossfade_port_value, jalv, 0, state_features);
+	lilv_instance_activate(instance);
+
+	/* Hand the new instance to the process thread and wait for the swap */
+	const uint32_t length = (uint32_t)(jalv->opts.crossfade *
+	                                   jalv->sample_rate / 1000.0f);
+	xfade->instance = instance;
+	xfade->length   = (length > 0) ? length : 1;
+	xfade->position = 0;
+	zix_atomic_store(&xfade->state, JALV_FADE_READY);
+	const bool swapped = jalv_wait_for_crossfade(jalv);
+
+	/* Free whichever instance is no longer run (the old one if swapped) */
+	lilv_instance_deactivate(xfade->instance);
+	lilv_instance_free(xfade->instance);
+	jalv_free_crossfade(jalv);
+
+	if (!swapped && !jalv->exit) {
+		fprintf(stderr, "warning: Crossfade stalled, restoring while paused\n");
+		return 1;
+	}
+
+	jalv->request_update = true;
+	zix_atomic_store(&jalv->restored, 1);
+	return 0;
+}
+
 void
 jalv_apply_state(Jalv* jalv, LilvState* state)
 {
 	bool must_pause = !jalv->safe_restore && jalv->play_state == JALV_RUNNING;
 	if (state) {
-		if (must_pause) {
-			jalv->play_state = JALV_PAUSE_REQUESTED;
-			zix_sem_wait(&jalv->paused);
-		}
-
 		const LV2_Feature* state_features[9] = {
 			&jalv->features.map_feature,
 			&jalv->features.unmap_feature,
@@ -195,8 +477,19 @@ jalv_apply_state(Jalv* jalv, LilvState* state)
 			NULL
 		};
 
+		if (must_pause && jalv_can_crossfade(jalv) &&
+		    !jalv_crossfade_state(jalv, state, state_features)) {
+			return;
+		}
+
+		if (must_pause) {
+			jalv->play_state = JALV_PAUSE_REQUESTED;
+			zix_sem_wait(&jalv->paused);
+		}
+
 		lilv_state_restore(
 			state, jalv->instance, set_port_value, jalv, 0, state_features);
+		zix_atomic_store(&jalv->restored, 1);
 
 		if (must_pause) {
 			jalv->request_update = true;
@@ -209,7 +502,7 @@ int
 jalv_apply_preset(Jalv* jalv, const LilvNode* preset)
 {
 	lilv_state_free(jalv->preset);
-	jalv->preset = lilv_state_new_from_world(jalv->world, &jalv->map, preset);
+	jalv->preset = jalv_load_preset(jalv, preset);
 	jalv_apply_state(jalv, jalv->preset);
 	return 0;
 }
@@ -236,6 +529,7 @@ jalv_save_preset(Jalv*       jalv,
 
 	lilv_state_free(jalv->preset);
 	jalv->preset = state;
+	jalv_free_presets(jalv);
 
 	return ret;
 }
@@ -251,5 +545,6 @@ jalv_delete_current_preset(Jalv* jalv)
 	lilv_state_delete(jalv->world, jalv->preset);
 	lilv_state_free(jalv->preset);
 	jalv->preset = NULL;
+	jalv_free_presets(jalv);
 	return 0;
 }
@@ -20,48 +20,93 @@
 #include <string.h>
 
 #include "symap.h"
+#include "zix/atomic.h"
 
 /**
   @file symap.c Implementation of Symap, a basic symbol map (string interner).
 
-  This implementation is primitive, but has some desirable qualities: good
-  (O(lg(n)) lookup performance for already-mapped symbols, minimal space
-  overhead, extremely fast (O(1)) reverse mapping (ID to string), simple code,
-  no dependencies.
-
-  The tradeoff is that mapping new symbols may be quite slow.  In other words,
-  this implementation is ideal for use cases with a relatively limited set of
-  symbols, or where most symbols are mapped early.  It will not fare so well
-  with very dynamic sets of symbols.  For that, you're better off with a
-  tree-based implementation (and the associated space cost, especially if you
-  need reverse mapping).
+  Symbols are stored in an arena and indexed by an open addressing hash table
+  of IDs, so mapping and unmapping are both O(1) expected time.
+
+  Memory is never moved while the map is alive: when the hash table or the
+  entry array grows, a new one is published atomically and the old one is
+  kept until symap_free().  This allows symap_try_map() and symap_unmap() to
+  run without any lock concurrently with a single thread calling symap_map().
 */
 
+/** Initial number of hash table slots, must be a power of two. */
+#define SYMAP_INITIAL_SLOTS 256u
+
+/** Size of arena chunks for symbol strings. */
+#define SYMAP_CHUNK_SIZE 4096u
+
+typedef struct {
+	const char* symbol;  ///< Symbol string in arena
+	uint32_t    hash;    ///< Hash of symbol
+} SymapEntry;
+
+typedef struct {
+	uint32_t mask;     ///< Number of slots - 1
+	uint32_t slots[];  ///< Symbol IDs, or 0 for empty slots
+} SymapTable;
+
+typedef struct SymapChunkImpl SymapChunk;
+
+struct SymapChunkImpl {
+	SymapChunk* next;     ///< Next (older) chunk
+	size_t      size;     ///< Size of data in bytes
+	size_t      used;     ///< Number of bytes used in data
+	char        data[];   ///< Symbol strings
+};
+
 struct SymapImpl {
 	/**
-	   Unsorted array of strings, such that the symbol for ID i is found
-	   at symbols[i - 1].
+	   Array of entries, such that the symbol for ID i is found at
+	   entries[i - 1].  Published atomically.
+	*/
+	SymapEntry* volatile entries;
+
+	/**
+	   Hash table of IDs.  Published atomically.
 	*/
-	char** symbols;
+	SymapTable* volatile table;
 
 	/**
-	   Array of IDs, sorted by corresponding string in `symbols`.
+	   Number of symbols (number of items in `entries`).  Published atomically.
 	*/
-	uint32_t* index;
+	volatile uint32_t size;
 
 	/**
-	   Number of symbols (number of items in `symbols` and `index`).
+	   Number of entries allocated in `entries`.
 	*/
-	uint32_t size;
+	uint32_t capacity;
+
+	/**
+	   Arena of symbol strings, newest chunk first.
+	*/
+	SymapChunk* chunks;
+
+	/**
+	   Tables and entry arrays that have been replaced, freed with the map.
+	*/
+	void**   retired;
+	uint32_t n_retired;
 };
 
+static SymapTable*
+symap_table_new(uint32_t n_slots)
+{
+	SymapTable* table = (SymapTable*)calloc(
+		1, sizeof(SymapTable) + n_slots * sizeof(uint32_t));
+	table->mask = n_slots - 1;
+	return table;
+}
+
 Symap*
 symap_new(void)
 {
-	Symap* map = (Symap*)malloc(sizeof(Symap));
-	map->symbols = NULL;
-	map->index   = NULL;
-	map->size    = 0;
+	Symap* map = (Symap*)calloc(1, sizeof(Symap));
+	map->table = symap_table_new(SYMAP_INITIAL_SLOTS);
 	return map;
 }
 
@@ -72,136 +117,255 @@ symap_free(Symap* map)
 		return;
 	}
 
-	for (uint32_t i = 0; i < map->size; ++i) {
-		free(map->symbols[i]);
+	for (SymapChunk* c = map->chunks; c;) {
+		SymapChunk* const next = c->next;
+		free(c);
+		c = next;
 	}
 
-	free(map->symbols);
-	free(map->index);
+	for (uint32_t i = 0; i < map->n_retired; ++i) {
+		free(map->retired[i]);
+	}
+
+	free(map->retired);
+	free(map->entries);
+	free(map->table);
 	free(map);
 }
 
-static char*
-symap_strdup(const char* str)
+/** FNV-1a hash of a string. */
+static uint32_t
+symap_hash(const char* sym, size_t* len)
+{
+	uint32_t     hash = 2166136261u;
+	const char*  s    = sym;
+	for (; *s; ++s) {
+		hash = (hash ^ (uint8_t)*s) * 16777619u;
+	}
+	*len = (size_t)(s - sym);
+	return hash;
+}
+
+/** Keep `ptr` alive until the map is freed, since readers may be using it. */
+static void
+symap_retire(Symap* map, void* ptr)
+{
+	map->retired = (void**)realloc(map->retired,
+	                               (map->n_retired + 1) * sizeof(void*));
+	map->retired[map->n_retired++] = ptr;
+}
+
+/** Copy `sym` into the arena. */
+static const char*
+symap_intern(Symap* map, const char* sym, size_t len)
 {
-	const size_t len  = strlen(str);
-	char*        copy = (char*)malloc(len + 1);
-	memcpy(copy, str, len + 1);
-	return copy;
+	SymapChunk* chunk = map->chunks;
+	if (!chunk || chunk->used + len + 1 > chunk->size) {
+		const size_t size = (len + 1 > SYMAP_CHUNK_SIZE)
+			? len + 1 : SYMAP_CHUNK_SIZE;
+
+		chunk       = (SymapChunk*)malloc(sizeof(SymapChunk) + size);
+		chunk->next = map->chunks;
+		chunk->size = size;
+		chunk->used = 0;
+		map->chunks = chunk;
+	}
+
+	char* const str = chunk->data + chunk->used;
+	memcpy(str, sym, len + 1);
+	chunk->used += len + 1;
+	return str;
 }
 
 /**
-   Return the index into map->index (not the ID) corresponding to `sym`,
-   or the index where a new entry for `sym` should be inserted.
+   Return the ID of `sym` in the published table, or 0.
+
+   This only reads published data, so it is safe to call concurrently with
+   symap_map().
 */
 static uint32_t
-symap_search(const Symap* map, const char* sym, bool* exact)
+symap_search(const Symap* map, const char* sym, uint32_t hash)
 {
-	*exact = false;
-	if (map->size == 0) {
-		return 0;  // Empty map, insert at 0
-	} else if (strcmp(map->symbols[map->index[map->size - 1] - 1], sym) < 0) {
-		return map->size;  // Greater than last element, append
-	}
-
-	uint32_t lower = 0;
-	uint32_t upper = map->size - 1;
-	uint32_t i     = upper;
-	int      cmp;
-
-	while (upper >= lower) {
-		i   = lower + ((upper - lower) / 2);
-		cmp = strcmp(map->symbols[map->index[i] - 1], sym);
-
-		if (cmp == 0) {
-			*exact = true;
-			return i;
-		} else if (cmp > 0) {
-			if (i == 0) {
-				break;  // Avoid underflow
-			}
-			upper = i - 1;
-		} else {
-			lower = ++i;
+	const SymapTable* const table = (const SymapTable*)zix_atomic_load_ptr(
+		(void* const volatile*)&map->table);
+
+	for (uint32_t i = hash & table->mask;; i = (i + 1) & table->mask) {
+		const uint32_t id = zix_atomic_load(&table->slots[i]);
+		if (!id) {
+			return 0;
+		}
+
+		/* Load entries after the ID, so they are at least as new */
+		const SymapEntry* const entries = (const SymapEntry*)
+			zix_atomic_load_ptr((void* const volatile*)&map->entries);
+
+		const SymapEntry* const entry = &entries[id - 1];
+		if (entry->hash == hash && !strcmp(entry->symbol, sym)) {
+			return id;
 		}
 	}
+}
 
-	assert(!*exact || strcmp(map->symbols[map->index[i] - 1], sym) > 0);
-	return i;
+/** Insert `id` into `table`, which must have a free slot. */
+static void
+symap_table_insert(SymapTable* table, uint32_t hash, uint32_t id)
+{
+	uint32_t i = hash & table->mask;
+	while (table->slots[i]) {
+		i = (i + 1) & table->mask;
+	}
+
+	zix_atomic_store(&table->slots[i], id);
 }
 
 uint32_t
 symap_try_map(Symap* map, const char* sym)
 {
-	bool           exact;
-	const uint32_t index = symap_search(map, sym, &exact);
-	if (exact) {
-		assert(!strcmp(map->symbols[map->index[index]], sym));
-		return map->index[index];
-	}
-
-	return 0;
+	size_t len = 0;
+	return symap_search(map, sym, symap_hash(sym, &len));
 }
 
 uint32_t
 symap_map(Symap* map, const char* sym)
 {
-	bool           exact;
-	const uint32_t index = symap_search(map, sym, &exact);
-	if (exact) {
-		assert(!strcmp(map->symbols[map->index[index] - 1], sym));
-		return map->index[index];
+	size_t         len  = 0;
+	const uint32_t hash = symap_hash(sym, &len);
+	const uint32_t id   = symap_search(map, sym, hash);
+	if (id) {
+		return id;
+	}
+
+	const uint32_t new_id = map->size + 1;
+
+	/* Grow entry array, publishing a complete copy */
+	if (map->size == map->capacity) {
+		const uint32_t    capacity = map->capacity ? map->capacity * 2 : 64;
+		SymapEntry* const entries  = (SymapEntry*)malloc(
+			capacity * sizeof(SymapEntry));
+		if (map->size) {
+			memcpy(entries, map->entries, map->size * sizeof(SymapEntry));
+		}
+
+		if (map->entries) {
+			symap_retire(map, map->entries);
+		}
+		zix_atomic_store_ptr((void* volatile*)&map->entries, entries);
+		map->capacity = capacity;
 	}
 
-	const uint32_t id  = ++map->size;
-	char* const    str = symap_strdup(sym);
+	/* Append new entry, which is not visible to readers until published */
+	map->entries[new_id - 1].symbol = symap_intern(map, sym, len);
+	map->entries[new_id - 1].hash   = hash;
 
-	/* Append new symbol to symbols array */
-	map->symbols = (char**)realloc(map->symbols, map->size * sizeof(str));
-	map->symbols[id - 1] = str;
+	/* Grow hash table to keep the load factor at most 1/2 */
+	SymapTable* table = map->table;
+	if (new_id > (table->mask + 1) / 2) {
+		SymapTable* const new_table = symap_table_new((table->mask + 1) * 2);
+		for (uint32_t i = 0; i < map->size; ++i) {
+			symap_table_insert(new_table, map->entries[i].hash, i + 1);
+		}
 
-	/* Insert new index element into sorted index */
-	map->index = (uint32_t*)realloc(map->index, map->size * sizeof(uint32_t));
-	if (index < map->size - 1) {
-		memmove(map->index + index + 1,
-		        map->index + index,
-		        (map->size - index - 1) * sizeof(uint32_t));
+		symap_retire(map, table);
+		zix_atomic_store_ptr((void* volatile*)&map->table, new_table);
+		table = new_table;
 	}
 
-	map->index[index] = id;
+	/* Publish new entry */
+	zix_atomic_store(&map->size, new_id);
+	symap_table_insert(table, hash, new_id);
 
-	return id;
+	return new_id;
 }
 
 const char*
 symap_unmap(Symap* map, uint32_t id)
 {
-	if (id == 0) {
+	if (id == 0 || id > zix_atomic_load(&map->size)) {
 		return NULL;
-	} else if (id <= map->size) {
-		return map->symbols[id - 1];
 	}
-	return NULL;
+
+	const SymapEntry* const entries = (const SymapEntry*)zix_atomic_load_ptr(
+		(void* const volatile*)&map->entries);
+
+	return entries[id - 1].symbol;
 }
 
 #ifdef STANDALONE
 
 #include <stdio.h>
+#include <time.h>
 
 static void
 symap_dump(Symap* map)
 {
 	fprintf(stderr, "{\n");
-	for (uint32_t i = 0; i < map->size; ++i) {
-		fprintf(stderr, "\t%u = %s\n",
-		        map->index[i], map->symbols[map->index[i] - 1]);
+	for (uint32_t i = 1; i <= map->size; ++i) {
+		fprintf(stderr, "\t%u = %s\n", i, symap_unmap(map, i));
 	}
 	fprintf(stderr, "}\n");
 }
 
+static double
+bench_time(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+/** Time mapping `n` new URIs, then mapping and unmapping them again. */
+static int
+symap_bench(uint32_t n)
+{
+	char** uris = (char**)malloc(n * sizeof(char*));
+	for (uint32_t i = 0; i < n; ++i) {
+		uris[i] = (char*)malloc(64);
+		snprintf(uris[i], 64, "http://example.org/plugins/p%u#port%u",
+		         i / 16, i % 16);
+	}
+
+	Symap* map = symap_new();
+
+	double t0 = bench_time();
+	for (uint32_t i = 0; i < n; ++i) {
+		symap_map(map, uris[i]);
+	}
+	const double insert = bench_time() - t0;
+
+	t0 = bench_time();
+	uint32_t sum = 0;
+	for (uint32_t i = 0; i < n; ++i) {
+		sum += symap_map(map, uris[i]);
+	}
+	const double lookup = bench_time() - t0;
+
+	t0 = bench_time();
+	size_t len = 0;
+	for (uint32_t i = 1; i <= n; ++i) {
+		len += strlen(symap_unmap(map, i));
+	}
+	const double unmap = bench_time() - t0;
+
+	printf("%u symbols (check %u %zu)\n", n, sum, len);
+	printf("insert: %8.1f ns/symbol\n", insert * 1e9 / n);
+	printf("lookup: %8.1f ns/symbol\n", lookup * 1e9 / n);
+	printf("unmap:  %8.1f ns/symbol\n", unmap * 1e9 / n);
+
+	symap_free(map);
+	for (uint32_t i = 0; i < n; ++i) {
+		free(uris[i]);
+	}
+	free(uris);
+	return 0;
+}
+
 int
-main()
+main(int argc, char** argv)
 {
+	if (argc > 1) {
+		return symap_bench((uint32_t)strtoul(argv[1], NULL, 10));
+	}
+
 	#define N_SYMS 5
 	char* syms[N_SYMS] = {
 		"hello", "bonjour", "goodbye", "aloha", "salut"
@@ -215,7 +379,7 @@ main()
 		}
 
 		const uint32_t id = symap_map(map, syms[i]);
-		if (strcmp(map->symbols[id - 1], syms[i])) {
+		if (strcmp(symap_unmap(map, id), syms[i])) {
 			fprintf(stderr, "error: Corrupt symbol table\n");
 			return 1;
 		}
@@ -228,6 +392,17 @@ main()
 		symap_dump(map);
 	}
 
+	/* Map enough symbols to grow the table several times */
+	for (uint32_t i = 0; i < 4096; ++i) {
+		char sym[32];
+		snprintf(sym, sizeof(sym), "sym%u", i);
+		const uint32_t id = symap_map(map, sym);
+		if (symap_try_map(map, sym) != id || strcmp(symap_unmap(map, id), sym)) {
+			fprintf(stderr, "error: Lost symbol after growing table\n");
+			return 1;
+		}
+	}
+
 	symap_free(map);
 	return 0;
 }
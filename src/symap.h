@@ -19,6 +19,9 @@
 
    Particularly useful for implementing LV2 URI mapping.
 
+   A single thread may add symbols with symap_map() while any number of other
+   threads call symap_try_map() and symap_unmap() without locking.
+
    @see <a href="http://lv2plug.in/ns/ext/urid">LV2 URID</a>
 */
 
@@ -45,6 +48,9 @@ symap_free(Symap* map);
 
 /**
    Map a string to a symbol ID if it is already mapped, otherwise return 0.
+
+   This does not allocate or lock, and may be called concurrently with
+   symap_map().
 */
 uint32_t
 symap_try_map(Symap* map, const char* sym);
@@ -60,7 +66,8 @@ symap_map(Symap* map, const char* sym);
 /**
    Unmap a symbol ID back to a symbol, or NULL if no such ID exists.
 
-   Note that 0 is never a valid symbol ID.
+   Note that 0 is never a valid symbol ID.  Like symap_try_map(), this may be
+   called concurrently with symap_map().
 */
 const char*
 symap_unmap(Symap* map, uint32_t id);
@@ -14,88 +14,446 @@
   OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
 */
 
+#include <assert.h>
+
 #include "worker.h"
 
+#include "zix/atomic.h"
+
+/**
+   Pool of threads that run scheduled work for every hosted instance.
+
+   The semaphore is posted once for every scheduled request, and every time
+   it is taken, a thread starts the most urgent queued request that can be
+   started now, skipping instances that are already running all the work they
+   can.  A thread that finishes a request posts the semaphore again if any
+   can be started, since threads woken while it was running may have found
+   nothing to start.
+
+   By default, only one thread at a time runs work for an instance, so
+   responses are sent in order while other threads run work for other
+   instances.  If a plugin declares jalv:threadSafeWork, its requests are
+   instead run by as many threads as are free, and the responses of each
+   request are buffered until those of all earlier requests have been sent.
+*/
+struct JalvWorkerPool {
+	ZixThread*   threads;     ///< Worker threads
+	uint32_t     n_threads;   ///< Number of worker threads
+	ZixSem       sem;         ///< Posted for every scheduled request
+	JalvWorker** workers;     ///< Threaded workers of all instances
+	uint32_t     n_workers;   ///< Number of workers
+	uint32_t     max_workers; ///< Size of workers array
+	uint32_t     next;        ///< Index of worker to check first
+	uint32_t     exit;        ///< Non-zero if threads must exit
+};
+
+/** Header of a request in the request ring, followed by the body. */
+typedef struct {
+	uint32_t size;      ///< Size of body in bytes
+	uint32_t time;      ///< Time scheduled in microseconds (wraps around)
+	uint32_t priority;  ///< JalvWorkPriority of request
+} JalvWorkRequest;
+
+/** Header of a response in the response ring, followed by the body. */
+typedef struct {
+	uint32_t size;   ///< Size of body in bytes
+	uint32_t cycle;  ///< Value of stats.n_cycles when written
+} JalvWorkResponse;
+
+/**
+   A request that is run concurrently with others, and its responses.
+
+   Each concurrent worker has one job per pool thread, with buffers as large
+   as its rings, so running requests never allocates memory.
+*/
+struct JalvWorkJob {
+	struct JalvWorkJob* next;     ///< Next free or finished job
+	JalvWorker*         worker;   ///< Worker the request was scheduled to
+	uint32_t            seq;      ///< Index of request in schedule order
+	uint32_t            size;     ///< Size of responses in bytes
+	uint32_t            sent;     ///< Size of responses already sent
+	void*               request;  ///< Request body
+	uint8_t*            data;     ///< Responses, each a header and body
+};
+
 static LV2_Worker_Status
 jalv_worker_respond(LV2_Worker_Respond_Handle handle,
                     uint32_t                  size,
                     const void*               data)
 {
-	JalvWorker* worker = (JalvWorker*)handle;
-	zix_ring_write(worker->responses, (const char*)&size, sizeof(size));
-	zix_ring_write(worker->responses, (const char*)data, size);
+	JalvWorker*            worker = (JalvWorker*)handle;
+	const JalvWorkResponse head   = {
+		size, zix_atomic_load(&worker->stats.n_cycles) };
+	if (!jalv_ring_write_message(
+		    worker->responses, &head, sizeof(head), data, size)) {
+		return LV2_WORKER_ERR_NO_SPACE;
+	}
+
+	jalv_update_max(&worker->stats.max_responses,
+	                zix_ring_read_space(worker->responses));
+	return LV2_WORKER_SUCCESS;
+}
+
+/** Buffer a response to a concurrent request until it can be sent. */
+static LV2_Worker_Status
+jalv_worker_respond_later(LV2_Worker_Respond_Handle handle,
+                          uint32_t                  size,
+                          const void*               data)
+{
+	struct JalvWorkJob*    job   = (struct JalvWorkJob*)handle;
+	const JalvWorkResponse head  = { size, 0 };
+	const uint32_t         space = job->worker->buf_size - job->size;
+	if (space < sizeof(head) || size > space - sizeof(head)) {
+		return LV2_WORKER_ERR_NO_SPACE;
+	}
+
+	memcpy(job->data + job->size, &head, sizeof(head));
+	memcpy(job->data + job->size + sizeof(head), data, size);
+	job->size += sizeof(head) + size;
 	return LV2_WORKER_SUCCESS;
 }
 
+/**
+   Return the priority of the most urgent queued request of `worker`.
+
+   Requests of an instance are always run in the order they were scheduled,
+   so this is the priority the instance is served with, even if the request
+   is behind less urgent ones.
+*/
+static JalvWorkPriority
+jalv_worker_next_priority(const JalvWorker* worker)
+{
+	uint32_t p = 0;
+	while (p < JALV_N_WORK_PRIORITIES &&
+	       !zix_atomic_load(&worker->n_pending[p])) {
+		++p;
+	}
+	return (JalvWorkPriority)p;
+}
+
+/**
+   Read the oldest request from `worker` into `buf`, or return false.
+
+   The buffer is as large as the rings, so any request fits, larger ones are
+   rejected by jalv_worker_schedule().
+*/
+static bool
+jalv_worker_read_request(JalvWorker* worker, void* buf, uint32_t* size)
+{
+	JalvWorkRequest head;
+	if (zix_ring_read_space(worker->requests) < sizeof(head)) {
+		return false;
+	}
+
+	zix_ring_read(worker->requests, (char*)&head, sizeof(head));
+	assert(head.size <= worker->buf_size);
+	zix_ring_read(worker->requests, (char*)buf, head.size);
+
+	zix_atomic_sub(&worker->n_pending[head.priority], 1);
+	zix_atomic_sub(&worker->stats.n_queued, 1);
+	jalv_histogram_add(&worker->stats.wait,
+	                   (uint32_t)jalv_time_us() - head.time);
+
+	*size = head.size;
+	return true;
+}
+
+/** Call the work() method of the plugin and record how long it took. */
+static void
+jalv_worker_work(JalvWorker*                 worker,
+                 LV2_Worker_Respond_Function respond,
+                 LV2_Worker_Respond_Handle   handle,
+                 uint32_t                    size,
+                 const void*                 data)
+{
+	const uint64_t start = jalv_time_us();
+	worker->iface->work(
+		worker->jalv->instance->lv2_handle, respond, handle, size, data);
+	jalv_histogram_add(&worker->stats.work, jalv_time_us() - start);
+}
+
+/**
+   Run the most urgent request of a serial worker, unless another thread is.
+
+   @return True if this thread had the worker to itself, in which case the
+   caller must check for requests that arrived while it was running.
+*/
+static bool
+jalv_worker_run_serial(JalvWorker* worker)
+{
+	Jalv* const jalv = worker->jalv;
+	uint32_t    size = 0;
+	if (zix_atomic_add(&worker->busy, 1)) {
+		return false;  // Another thread is running work for this instance
+	}
+
+	if (jalv_worker_read_request(worker, worker->request, &size)) {
+		zix_sem_wait(&jalv->work_lock);
+		jalv_worker_work(
+			worker, jalv_worker_respond, worker, size, worker->request);
+		zix_sem_post(&jalv->work_lock);
+	}
+
+	zix_atomic_store(&worker->busy, 0);
+	return true;
+}
+
+/**
+   Send the responses of finished jobs that are next in order.
+
+   If the response ring is full, the job stays finished with the responses
+   that were not sent yet, and jalv_worker_emit_responses() calls this again
+   once the audio thread has made space.  The caller must hold the lock.
+*/
+static void
+jalv_worker_send_finished(JalvWorker* worker)
+{
+	for (struct JalvWorkJob** j = &worker->finished; *j;) {
+		struct JalvWorkJob* const job = *j;
+		if (job->seq != worker->n_finished) {
+			j = &job->next;
+			continue;
+		}
+
+		while (job->sent < job->size) {
+			JalvWorkResponse head;
+			memcpy(&head, job->data + job->sent, sizeof(head));
+			if (jalv_worker_respond(
+				    worker, head.size, job->data + job->sent + sizeof(head))) {
+				zix_atomic_add(&worker->stats.n_deferred, 1);
+				zix_atomic_store(&worker->deferred, 1);
+				return;
+			}
+			job->sent += sizeof(head) + head.size;
+		}
+
+		/* Free job and start over, a later one may be next now */
+		*j        = job->next;
+		job->next = worker->free_jobs;
+		zix_atomic_store_ptr((void* volatile*)&worker->free_jobs, job);
+		++worker->n_finished;
+		j = &worker->finished;
+	}
+
+	zix_atomic_store(&worker->deferred, 0);
+}
+
+/**
+   Run the most urgent request of a concurrent worker if there is a free job.
+
+   If every job is taken, the oldest is still running, and the thread running
+   it will check for remaining requests once it has finished.
+
+   @return True if a request was run, in which case the caller must check for
+   requests that arrived while it was running.
+*/
+static bool
+jalv_worker_run_concurrent(JalvWorker* worker)
+{
+	zix_sem_wait(&worker->lock);
+	struct JalvWorkJob* const job  = worker->free_jobs;
+	uint32_t                  size = 0;
+	if (!job || !jalv_worker_read_request(worker, job->request, &size)) {
+		zix_sem_post(&worker->lock);
+		return false;
+	}
+	zix_atomic_store_ptr((void* volatile*)&worker->free_jobs, job->next);
+	job->seq  = worker->n_started++;
+	job->size = 0;
+	job->sent = 0;
+	zix_sem_post(&worker->lock);
+
+	jalv_worker_work(
+		worker, jalv_worker_respond_later, job, size, job->request);
+
+	zix_sem_wait(&worker->lock);
+	job->next        = worker->finished;
+	worker->finished = job;
+	jalv_worker_send_finished(worker);
+	zix_sem_post(&worker->lock);
+	return true;
+}
+
+/**
+   Return true iff a pool thread could start a request of `worker` now.
+
+   This is only a hint, since another thread may start one first, but it
+   avoids waking up to choose a worker that is already running all it can.
+*/
+static bool
+jalv_worker_is_runnable(JalvWorker* worker)
+{
+	return worker->concurrent
+		? zix_atomic_load_ptr((void* const volatile*)&worker->free_jobs) != NULL
+		: !zix_atomic_load(&worker->busy);
+}
+
+/** Return the runnable worker with the most urgent queued request, or NULL. */
+static JalvWorker*
+jalv_worker_pool_next(JalvWorkerPool* pool)
+{
+	/* Start with the instance after the one the last thread started with, so
+	   instances with requests of the same priority take turns */
+	const uint32_t   n_workers = zix_atomic_load(&pool->n_workers);
+	const uint32_t   first     = zix_atomic_add(&pool->next, 1);
+	JalvWorker*      best      = NULL;
+	JalvWorkPriority best_p    = JALV_N_WORK_PRIORITIES;
+	for (uint32_t i = 0; i < n_workers; ++i) {
+		JalvWorker* const      worker = pool->workers[(first + i) % n_workers];
+		const JalvWorkPriority p      = jalv_worker_next_priority(worker);
+		if (p < best_p && jalv_worker_is_runnable(worker)) {
+			best   = worker;
+			best_p = p;
+		}
+	}
+	return best;
+}
+
 static void*
-worker_func(void* data)
+jalv_worker_pool_thread(void* data)
 {
-	JalvWorker* worker = (JalvWorker*)data;
-	Jalv*       jalv   = worker->jalv;
-	void*       buf    = NULL;
+	JalvWorkerPool* pool = (JalvWorkerPool*)data;
 	while (true) {
-		zix_sem_wait(&worker->sem);
-		if (jalv->exit) {
+		zix_sem_wait(&pool->sem);
+		if (zix_atomic_load(&pool->exit)) {
 			break;
 		}
 
-		uint32_t size = 0;
-		zix_ring_read(worker->requests, (char*)&size, sizeof(size));
+		/* Run the most urgent runnable request, choosing again if another
+		   thread started it first.  If nothing is runnable, the threads
+		   running work will wake another when they finish. */
+		JalvWorker* worker = NULL;
+		while ((worker = jalv_worker_pool_next(pool)) &&
+		       !(worker->concurrent ? jalv_worker_run_concurrent(worker)
+		                            : jalv_worker_run_serial(worker))) {
+		}
 
-		if (!(buf = realloc(buf, size))) {
-			fprintf(stderr, "error: realloc() failed\n");
-			free(buf);
-			return NULL;
+		/* Wake another thread if there are more requests it can start */
+		if (worker && jalv_worker_pool_next(pool)) {
+			zix_sem_post(&pool->sem);
 		}
+	}
 
-		zix_ring_read(worker->requests, (char*)buf, size);
+	return NULL;
+}
 
-		zix_sem_wait(&jalv->work_lock);
-		worker->iface->work(
-			jalv->instance->lv2_handle, jalv_worker_respond, worker, size, buf);
-		zix_sem_post(&jalv->work_lock);
+JalvWorkerPool*
+jalv_worker_pool_new(uint32_t n_threads, uint32_t max_workers)
+{
+	JalvWorkerPool* pool = (JalvWorkerPool*)calloc(1, sizeof(JalvWorkerPool));
+	pool->threads     = (ZixThread*)calloc(n_threads, sizeof(ZixThread));
+	pool->workers     = (JalvWorker**)calloc(max_workers, sizeof(JalvWorker*));
+	pool->max_workers = max_workers;
+	zix_sem_init(&pool->sem, 0);
+
+	for (uint32_t i = 0; i < n_threads; ++i) {
+		if (zix_thread_create(&pool->threads[pool->n_threads],
+		                      4096,
+		                      jalv_worker_pool_thread,
+		                      pool)) {
+			fprintf(stderr, "warning: Failed to create worker thread\n");
+			break;
+		}
+		++pool->n_threads;
 	}
 
-	free(buf);
-	return NULL;
+	return pool;
+}
+
+void
+jalv_worker_pool_finish(JalvWorkerPool* pool)
+{
+	if (pool && !zix_atomic_add(&pool->exit, 1)) {
+		for (uint32_t i = 0; i < pool->n_threads; ++i) {
+			zix_sem_post(&pool->sem);
+		}
+		for (uint32_t i = 0; i < pool->n_threads; ++i) {
+			zix_thread_join(pool->threads[i], NULL);
+		}
+	}
+}
+
+void
+jalv_worker_pool_free(JalvWorkerPool* pool)
+{
+	if (pool) {
+		jalv_worker_pool_finish(pool);
+		zix_sem_destroy(&pool->sem);
+		free(pool->threads);
+		free(pool->workers);
+		free(pool);
+	}
 }
 
 void
-jalv_worker_init(ZIX_UNUSED Jalv*            jalv,
+jalv_worker_init(Jalv*                       jalv,
                  JalvWorker*                 worker,
                  const LV2_Worker_Interface* iface,
                  bool                        threaded)
 {
-	worker->iface = iface;
-	worker->threaded = threaded;
+	worker->iface      = iface;
+	worker->threaded   = threaded;
+	worker->concurrent = lilv_plugin_has_feature(
+		jalv->plugin, jalv->nodes.jalv_threadSafeWork);
+	zix_sem_init(&worker->lock, 1);
+
+	/* Size rings like the UI rings, which fit the largest declared port
+	   buffer (rsz:minimumSize) several times, and can be set with -b */
+	worker->responses = zix_ring_new(jalv->opts.buffer_size);
+	worker->buf_size  = zix_ring_capacity(worker->responses);
+	worker->response  = malloc(worker->buf_size);
+	zix_ring_mlock(worker->responses);
+
 	if (threaded) {
-		zix_thread_create(&worker->thread, 4096, worker_func, worker);
-		worker->requests = zix_ring_new(4096);
+		worker->requests = zix_ring_new(jalv->opts.buffer_size);
+		worker->priority = JALV_WORK_BACKGROUND;
 		zix_ring_mlock(worker->requests);
-	}
-	worker->responses = zix_ring_new(4096);
-	worker->response  = malloc(4096);
-	zix_ring_mlock(worker->responses);
-}
 
-void
-jalv_worker_finish(JalvWorker* worker)
-{
-	if (worker->threaded) {
-		zix_sem_post(&worker->sem);
-		zix_thread_join(worker->thread, NULL);
+		if (worker->concurrent) {
+			/* Allocate a job for every thread that may run a request */
+			const uint32_t n_jobs = jalv->worker_pool->n_threads;
+			worker->jobs = (struct JalvWorkJob*)calloc(
+				n_jobs, sizeof(struct JalvWorkJob));
+			for (uint32_t i = 0; i < n_jobs; ++i) {
+				struct JalvWorkJob* const job = &worker->jobs[i];
+				job->next         = worker->free_jobs;
+				job->worker       = worker;
+				job->request      = malloc(worker->buf_size);
+				job->data         = (uint8_t*)malloc(worker->buf_size);
+				worker->free_jobs = job;
+			}
+		} else {
+			worker->request = malloc(worker->buf_size);
+		}
+
+		/* Publish worker to pool threads only once it is ready */
+		JalvWorkerPool* const pool = jalv->worker_pool;
+		assert(pool->n_workers < pool->max_workers);
+		worker->pool                   = pool;
+		pool->workers[pool->n_workers] = worker;
+		zix_atomic_store(&pool->n_workers, pool->n_workers + 1);
 	}
 }
 
 void
 jalv_worker_destroy(JalvWorker* worker)
 {
-	if (worker->requests) {
-		if (worker->threaded) {
+	if (worker->responses) {
+		if (worker->requests) {
 			zix_ring_free(worker->requests);
 		}
 		zix_ring_free(worker->responses);
+		free(worker->request);
 		free(worker->response);
+		zix_sem_destroy(&worker->lock);
+	}
+
+	if (worker->jobs) {
+		for (uint32_t i = 0; i < worker->pool->n_threads; ++i) {
+			free(worker->jobs[i].request);
+			free(worker->jobs[i].data);
+		}
+		free(worker->jobs);
 	}
 }
 
@@ -107,10 +465,25 @@ jalv_worker_schedule(LV2_Worker_Schedule_Handle handle,
 	JalvWorker* worker = (JalvWorker*)handle;
 	Jalv*       jalv   = worker->jalv;
 	if (worker->threaded) {
-		// Schedule a request to be executed by the worker thread
-		zix_ring_write(worker->requests, (const char*)&size, sizeof(size));
-		zix_ring_write(worker->requests, (const char*)data, size);
-		zix_sem_post(&worker->sem);
+		// Schedule a request to be executed by the worker pool
+		ZixRing* const        ring = worker->requests;
+		const JalvWorkRequest head = {
+			size, (uint32_t)jalv_time_us(), worker->priority };
+
+		/* Count the request first, so a thread that reads it never sees a
+		   count of zero for its priority */
+		zix_atomic_add(&worker->n_pending[head.priority], 1);
+		if (!jalv_ring_write_message(ring, &head, sizeof(head), data, size)) {
+			zix_atomic_sub(&worker->n_pending[head.priority], 1);
+			return LV2_WORKER_ERR_NO_SPACE;
+		}
+
+		JalvWorkerStats* const stats  = &worker->stats;
+		const uint32_t         queued = zix_atomic_add(&stats->n_queued, 1) + 1;
+		zix_atomic_add(&stats->n_requests, 1);
+		jalv_update_max(&stats->max_queued, queued);
+		jalv_update_max(&stats->max_requests, zix_ring_read_space(ring));
+		zix_sem_post(&worker->pool->sem);
 	} else {
 		// Execute work immediately in this thread
 		zix_sem_wait(&jalv->work_lock);
@@ -125,17 +498,41 @@ void
 jalv_worker_emit_responses(JalvWorker* worker, LilvInstance* instance)
 {
 	if (worker->responses) {
-		uint32_t read_space = zix_ring_read_space(worker->responses);
+		JalvWorkerStats* const stats      = &worker->stats;
+		const uint32_t         cycle      = zix_atomic_load(&stats->n_cycles);
+		uint32_t               read_space = zix_ring_read_space(worker->responses);
 		while (read_space) {
-			uint32_t size = 0;
-			zix_ring_read(worker->responses, (char*)&size, sizeof(size));
+			JalvWorkResponse head;
+			zix_ring_read(worker->responses, (char*)&head, sizeof(head));
+
+			/* Responses larger than the ring are never written, but check
+			   the size anyway so a bad one can never overrun the buffer */
+			if (head.size > worker->buf_size) {
+				zix_ring_skip(worker->responses, head.size);
+			} else {
+				zix_ring_read(
+					worker->responses, (char*)worker->response, head.size);
+				worker->iface->work_response(
+					instance->lv2_handle, head.size, worker->response);
+				zix_atomic_add(&stats->n_responses, 1);
+				jalv_histogram_add(&stats->delay, cycle - head.cycle);
+			}
 
-			zix_ring_read(worker->responses, (char*)worker->response, size);
+			read_space -= sizeof(head) + head.size;
+		}
+		zix_atomic_store(&stats->n_cycles, cycle + 1);
 
-			worker->iface->work_response(
-				instance->lv2_handle, size, worker->response);
+		/* Send responses deferred because the ring was full, unless a worker
+		   thread holds the lock, in which case it sends them itself */
+		if (zix_atomic_load(&worker->deferred) &&
+		    zix_sem_try_wait(&worker->lock)) {
+			jalv_worker_send_finished(worker);
+			zix_sem_post(&worker->lock);
 
-			read_space -= sizeof(size) + size;
+			/* Wake a thread for requests left waiting for a free job */
+			if (zix_atomic_load(&stats->n_queued)) {
+				zix_sem_post(&worker->pool->sem);
+			}
 		}
 	}
 }
@@ -18,15 +18,28 @@
 
 #include "jalv_internal.h"
 
+/**
+   Create a pool of `n_threads` threads to run work for up to `max_workers`.
+
+   Every hosted instance shares the pool of the host, so one slow request does
+   not hold up work for the others.
+*/
+JalvWorkerPool*
+jalv_worker_pool_new(uint32_t n_threads, uint32_t max_workers);
+
+/** Stop and join the threads of `pool`, unfinished requests are discarded. */
+void
+jalv_worker_pool_finish(JalvWorkerPool* pool);
+
+void
+jalv_worker_pool_free(JalvWorkerPool* pool);
+
 void
 jalv_worker_init(Jalv*                       jalv,
                  JalvWorker*                 worker,
                  const LV2_Worker_Interface* iface,
                  bool                        threaded);
 
-void
-jalv_worker_finish(JalvWorker* worker);
-
 void
 jalv_worker_destroy(JalvWorker* worker);
 
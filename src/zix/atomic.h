@@ -0,0 +1,245 @@
+/*
+  Copyright 2012-2019 David Robillard <http://drobilla.net>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THIS SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#ifndef ZIX_ATOMIC_H
+#define ZIX_ATOMIC_H
+
+#include <stdint.h>
+
+#if defined(_WIN32) && !defined(__GNUC__)
+#    include <windows.h>
+#endif
+
+#include "zix/common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+   @addtogroup zix
+   @{
+   @name Atomic
+   @{
+*/
+
+/**
+   Load `*ptr` with acquire semantics.
+*/
+static inline uint32_t
+zix_atomic_load(const volatile uint32_t* ptr);
+
+/**
+   Store `value` to `*ptr` with release semantics.
+*/
+static inline void
+zix_atomic_store(volatile uint32_t* ptr, uint32_t value);
+
+/**
+   Add `value` to `*ptr` and return the previous value.
+*/
+static inline uint32_t
+zix_atomic_add(volatile uint32_t* ptr, uint32_t value);
+
+/**
+   Subtract `value` from `*ptr` and return the previous value.
+*/
+static inline uint32_t
+zix_atomic_sub(volatile uint32_t* ptr, uint32_t value);
+
+/**
+   Set `*ptr` to `desired` if it equals `expected`, and return the previous
+   value, which equals `expected` iff `*ptr` was changed.
+*/
+static inline uint32_t
+zix_atomic_cas(volatile uint32_t* ptr, uint32_t expected, uint32_t desired);
+
+/**
+   Load the pointer at `ptr` with acquire semantics.
+*/
+static inline void*
+zix_atomic_load_ptr(void* const volatile* ptr);
+
+/**
+   Store `value` to the pointer at `ptr` with release semantics.
+*/
+static inline void
+zix_atomic_store_ptr(void* volatile* ptr, void* value);
+
+/**
+   @cond
+*/
+
+#if defined(__GNUC__) && defined(__ATOMIC_ACQUIRE)
+
+static inline uint32_t
+zix_atomic_load(const volatile uint32_t* ptr)
+{
+	return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+}
+
+static inline void
+zix_atomic_store(volatile uint32_t* ptr, uint32_t value)
+{
+	__atomic_store_n(ptr, value, __ATOMIC_RELEASE);
+}
+
+static inline uint32_t
+zix_atomic_add(volatile uint32_t* ptr, uint32_t value)
+{
+	return __atomic_fetch_add(ptr, value, __ATOMIC_ACQ_REL);
+}
+
+static inline uint32_t
+zix_atomic_sub(volatile uint32_t* ptr, uint32_t value)
+{
+	return __atomic_fetch_sub(ptr, value, __ATOMIC_ACQ_REL);
+}
+
+static inline uint32_t
+zix_atomic_cas(volatile uint32_t* ptr, uint32_t expected, uint32_t desired)
+{
+	__atomic_compare_exchange_n(ptr, &expected, desired, 0,
+	                            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+	return expected;
+}
+
+static inline void*
+zix_atomic_load_ptr(void* const volatile* ptr)
+{
+	return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+}
+
+static inline void
+zix_atomic_store_ptr(void* volatile* ptr, void* value)
+{
+	__atomic_store_n(ptr, value, __ATOMIC_RELEASE);
+}
+
+#elif defined(_WIN32)
+
+static inline uint32_t
+zix_atomic_load(const volatile uint32_t* ptr)
+{
+	const uint32_t value = *ptr;
+	MemoryBarrier();
+	return value;
+}
+
+static inline void
+zix_atomic_store(volatile uint32_t* ptr, uint32_t value)
+{
+	MemoryBarrier();
+	*ptr = value;
+}
+
+static inline uint32_t
+zix_atomic_add(volatile uint32_t* ptr, uint32_t value)
+{
+	return (uint32_t)InterlockedExchangeAdd((volatile LONG*)ptr, (LONG)value);
+}
+
+static inline uint32_t
+zix_atomic_sub(volatile uint32_t* ptr, uint32_t value)
+{
+	return (uint32_t)InterlockedExchangeAdd((volatile LONG*)ptr, -(LONG)value);
+}
+
+static inline uint32_t
+zix_atomic_cas(volatile uint32_t* ptr, uint32_t expected, uint32_t desired)
+{
+	return (uint32_t)InterlockedCompareExchange(
+		(volatile LONG*)ptr, (LONG)desired, (LONG)expected);
+}
+
+static inline void*
+zix_atomic_load_ptr(void* const volatile* ptr)
+{
+	void* const value = *ptr;
+	MemoryBarrier();
+	return value;
+}
+
+static inline void
+zix_atomic_store_ptr(void* volatile* ptr, void* value)
+{
+	MemoryBarrier();
+	*ptr = value;
+}
+
+#else  /* Legacy GCC */
+
+static inline uint32_t
+zix_atomic_load(const volatile uint32_t* ptr)
+{
+	const uint32_t value = *ptr;
+	__sync_synchronize();
+	return value;
+}
+
+static inline void
+zix_atomic_store(volatile uint32_t* ptr, uint32_t value)
+{
+	__sync_synchronize();
+	*ptr = value;
+}
+
+static inline uint32_t
+zix_atomic_add(volatile uint32_t* ptr, uint32_t value)
+{
+	return __sync_fetch_and_add(ptr, value);
+}
+
+static inline uint32_t
+zix_atomic_sub(volatile uint32_t* ptr, uint32_t value)
+{
+	return __sync_fetch_and_sub(ptr, value);
+}
+
+static inline uint32_t
+zix_atomic_cas(volatile uint32_t* ptr, uint32_t expected, uint32_t desired)
+{
+	return __sync_val_compare_and_swap(ptr, expected, desired);
+}
+
+static inline void*
+zix_atomic_load_ptr(void* const volatile* ptr)
+{
+	void* const value = *ptr;
+	__sync_synchronize();
+	return value;
+}
+
+static inline void
+zix_atomic_store_ptr(void* volatile* ptr, void* value)
+{
+	__sync_synchronize();
+	*ptr = value;
+}
+
+#endif
+
+/**
+   @endcond
+   @}
+   @}
+*/
+
+#ifdef __cplusplus
+}  /* extern "C" */
+#endif
+
+#endif  /* ZIX_ATOMIC_H */
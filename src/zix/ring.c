@@ -53,11 +53,11 @@
 #include "zix/ring.h"
 
 struct ZixRingImpl {
-	uint32_t write_head;  ///< Read index into buf
-	uint32_t read_head;   ///< Write index into buf
-	uint32_t size;        ///< Size (capacity) in bytes
-	uint32_t size_mask;   ///< Mask for fast modulo
-	char*    buf;         ///< Contents
+	volatile uint32_t write_head;  ///< Write index into buf
+	volatile uint32_t read_head;   ///< Read index into buf
+	uint32_t          size;        ///< Size (capacity) in bytes
+	uint32_t          size_mask;   ///< Mask for fast modulo
+	char*             buf;         ///< Contents
 };
 
 static inline uint32_t
@@ -203,8 +203,82 @@ zix_ring_skip(ZixRing* ring, uint32_t size)
 	return size;
 }
 
+ZixRingTransaction
+zix_ring_begin_write(ZixRing* ring)
+{
+	const uint32_t           r  = ring->read_head;
+	const uint32_t           w  = ring->write_head;
+	const ZixRingTransaction tx = { r, w };
+	return tx;
+}
+
+ZixStatus
+zix_ring_amend_write(ZixRing*            ring,
+                     ZixRingTransaction* tx,
+                     const void*         src,
+                     uint32_t            size)
+{
+	const uint32_t r = tx->read_head;
+	const uint32_t w = tx->write_head;
+	if (write_space_internal(ring, r, w) < size) {
+		return ZIX_STATUS_NO_MEM;
+	}
+
+	if (w + size <= ring->size) {
+		memcpy(&ring->buf[w], src, size);
+	} else {
+		const uint32_t this_size = ring->size - w;
+		memcpy(&ring->buf[w], src, this_size);
+		memcpy(&ring->buf[0], (const char*)src + this_size, size - this_size);
+	}
+
+	tx->write_head = (w + size) & ring->size_mask;
+	return ZIX_STATUS_SUCCESS;
+}
+
+ZixStatus
+zix_ring_commit_write(ZixRing* ring, const ZixRingTransaction* tx)
+{
+	ZIX_WRITE_BARRIER();
+	ring->write_head = tx->write_head;
+	return ZIX_STATUS_SUCCESS;
+}
+
 uint32_t
 zix_ring_write(ZixRing* ring, const void* src, uint32_t size)
+{
+	ZixRingTransaction tx = zix_ring_begin_write(ring);
+	if (zix_ring_amend_write(ring, &tx, src, size)) {
+		return 0;
+	}
+
+	zix_ring_commit_write(ring, &tx);
+	return size;
+}
+
+uint32_t
+zix_ring_peek_vector(ZixRing* ring, ZixRingVector* vec)
+{
+	const uint32_t r     = ring->read_head;
+	const uint32_t w     = ring->write_head;
+	const uint32_t space = read_space_internal(ring, r, w);
+
+	ZIX_READ_BARRIER();
+	vec->data[0] = &ring->buf[r];
+	vec->data[1] = &ring->buf[0];
+	if (r + space <= ring->size) {
+		vec->size[0] = space;
+		vec->size[1] = 0;
+	} else {
+		vec->size[0] = ring->size - r;
+		vec->size[1] = space - vec->size[0];
+	}
+
+	return space;
+}
+
+uint32_t
+zix_ring_reserve(ZixRing* ring, uint32_t size, ZixRingVector* vec)
 {
 	const uint32_t r = ring->read_head;
 	const uint32_t w = ring->write_head;
@@ -212,17 +286,130 @@ zix_ring_write(ZixRing* ring, const void* src, uint32_t size)
 		return 0;
 	}
 
+	vec->data[0] = &ring->buf[w];
+	vec->data[1] = &ring->buf[0];
 	if (w + size <= ring->size) {
-		memcpy(&ring->buf[w], src, size);
-		ZIX_WRITE_BARRIER();
-		ring->write_head = (w + size) & ring->size_mask;
+		vec->size[0] = size;
+		vec->size[1] = 0;
 	} else {
-		const uint32_t this_size = ring->size - w;
-		memcpy(&ring->buf[w], src, this_size);
-		memcpy(&ring->buf[0], (const char*)src + this_size, size - this_size);
-		ZIX_WRITE_BARRIER();
-		ring->write_head = size - this_size;
+		vec->size[0] = ring->size - w;
+		vec->size[1] = size - vec->size[0];
 	}
 
 	return size;
 }
+
+uint32_t
+zix_ring_commit(ZixRing* ring, uint32_t size)
+{
+	const uint32_t w = ring->write_head;
+
+	ZIX_WRITE_BARRIER();
+	ring->write_head = (w + size) & ring->size_mask;
+	return size;
+}
+
+void
+zix_ring_vector_write(const ZixRingVector* vec,
+                      uint32_t             offset,
+                      const void*          src,
+                      uint32_t             size)
+{
+	if (offset + size <= vec->size[0]) {
+		memcpy(vec->data[0] + offset, src, size);
+	} else if (offset >= vec->size[0]) {
+		memcpy(vec->data[1] + offset - vec->size[0], src, size);
+	} else {
+		const uint32_t first_size = vec->size[0] - offset;
+		memcpy(vec->data[0] + offset, src, first_size);
+		memcpy(vec->data[1], (const char*)src + first_size, size - first_size);
+	}
+}
+
+#ifdef STANDALONE
+
+#include <sched.h>
+#include <stdio.h>
+
+#include "zix/thread.h"
+
+#define MSG_COUNT     1000000
+#define MSG_MAX_SIZE  200
+#define RING_SIZE     1024
+
+typedef struct {
+	uint32_t seq;   ///< Sequence number
+	uint32_t size;  ///< Size of body in bytes
+} TestHeader;
+
+static void*
+writer(void* data)
+{
+	ZixRing* ring = (ZixRing*)data;
+	uint8_t  body[MSG_MAX_SIZE];
+	for (uint32_t seq = 0; seq < MSG_COUNT;) {
+		const TestHeader head = { seq, (seq * 7919u) % MSG_MAX_SIZE };
+		for (uint32_t i = 0; i < head.size; ++i) {
+			body[i] = (uint8_t)(seq + i);
+		}
+
+		/* Write header and body in parts, retrying until there is space */
+		ZixRingTransaction tx = zix_ring_begin_write(ring);
+		if (!zix_ring_amend_write(ring, &tx, &head, sizeof(head)) &&
+		    !zix_ring_amend_write(ring, &tx, body, head.size / 2) &&
+		    !zix_ring_amend_write(ring, &tx, body + head.size / 2,
+		                          head.size - head.size / 2)) {
+			zix_ring_commit_write(ring, &tx);
+			++seq;
+		} else {
+			sched_yield();
+		}
+	}
+
+	return NULL;
+}
+
+/** Stress test multi-part writes from one thread while reading in another. */
+int
+main(void)
+{
+	ZixRing*  ring = zix_ring_new(RING_SIZE);
+	ZixThread thread;
+	zix_thread_create(&thread, 4096, writer, ring);
+
+	uint8_t body[MSG_MAX_SIZE];
+	for (uint32_t seq = 0; seq < MSG_COUNT;) {
+		const uint32_t space = zix_ring_read_space(ring);
+		TestHeader     head;
+		if (space < sizeof(head)) {
+			sched_yield();
+			continue;
+		}
+
+		zix_ring_peek(ring, &head, sizeof(head));
+		if (space < sizeof(head) + head.size) {
+			fprintf(stderr, "error: Partial message %u visible\n", seq);
+			return 1;
+		} else if (head.seq != seq) {
+			fprintf(stderr, "error: Message %u out of order\n", seq);
+			return 1;
+		}
+
+		zix_ring_skip(ring, sizeof(head));
+		zix_ring_read(ring, body, head.size);
+		for (uint32_t i = 0; i < head.size; ++i) {
+			if (body[i] != (uint8_t)(seq + i)) {
+				fprintf(stderr, "error: Corrupt message %u\n", seq);
+				return 1;
+			}
+		}
+		++seq;
+	}
+
+	zix_thread_join(thread, NULL);
+	zix_ring_free(ring);
+	printf("Read %u messages\n", MSG_COUNT);
+	return 0;
+}
+
+#endif  /* STANDALONE */
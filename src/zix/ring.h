@@ -40,6 +40,18 @@ extern "C" {
 */
 typedef struct ZixRingImpl ZixRing;
 
+/**
+   A region of ring memory, which may wrap around the end of the ring.
+
+   The region is the first `size[0]` bytes at `data[0]`, followed by the
+   `size[1]` bytes at `data[1]`, where the second part is only used if the
+   region wraps around.
+*/
+typedef struct {
+	char*    data[2];  ///< Start of each contiguous part
+	uint32_t size[2];  ///< Size of each contiguous part in bytes
+} ZixRingVector;
+
 /**
    Create a new ring.
    @param size Size in bytes (note this may be rounded up).
@@ -118,6 +130,85 @@ zix_ring_skip(ZixRing* ring, uint32_t size);
 uint32_t
 zix_ring_write(ZixRing* ring, const void* src, uint32_t size);
 
+/**
+   A transaction for writing data in multiple parts.
+
+   The simplest way to write to a ring is with zix_ring_write(), but in order
+   to write a message with a header and body all at once, a transaction is
+   used: it is started with zix_ring_begin_write(), extended with
+   zix_ring_amend_write(), and made visible to the reader with
+   zix_ring_commit_write().  Either the whole message is written, or nothing.
+*/
+typedef struct {
+	uint32_t read_head;   ///< Read head at the start of the transaction
+	uint32_t write_head;  ///< Write head if the transaction were committed
+} ZixRingTransaction;
+
+/**
+   Start a write transaction.
+
+   This does not write anything, so it may be abandoned without any cleanup.
+*/
+ZixRingTransaction
+zix_ring_begin_write(ZixRing* ring);
+
+/**
+   Amend the current transaction with more data.
+
+   @return ZIX_STATUS_NO_MEM if there is not enough space for all data written
+   in this transaction so far, in which case the transaction must be abandoned.
+*/
+ZixStatus
+zix_ring_amend_write(ZixRing*            ring,
+                     ZixRingTransaction* tx,
+                     const void*         src,
+                     uint32_t            size);
+
+/**
+   Commit the current transaction, making all of its data visible to the
+   reader at once.
+*/
+ZixStatus
+zix_ring_commit_write(ZixRing* ring, const ZixRingTransaction* tx);
+
+/**
+   Get a view of all data available for reading, without copying.
+
+   The data may be parsed in place, then released with zix_ring_skip().  This
+   may only be called by the reader.
+
+   @return The number of bytes available, which is the total size of `vec`.
+*/
+uint32_t
+zix_ring_peek_vector(ZixRing* ring, ZixRingVector* vec);
+
+/**
+   Reserve `size` bytes of space for writing in place.
+
+   The reserved space may be written with zix_ring_vector_write() or
+   directly, and is not visible to the reader until zix_ring_commit() is
+   called.  This may only be called by the writer.
+
+   @return `size` on success, or zero if there is not enough space.
+*/
+uint32_t
+zix_ring_reserve(ZixRing* ring, uint32_t size, ZixRingVector* vec);
+
+/**
+   Make `size` bytes of previously reserved space visible to the reader.
+*/
+uint32_t
+zix_ring_commit(ZixRing* ring, uint32_t size);
+
+/**
+   Copy `size` bytes from `src` into a reserved region at `offset`.
+*/
+void
+zix_ring_vector_write(const ZixRingVector* vec,
+                      uint32_t             offset,
+                      const void*          src,
+                      uint32_t             size);
+
 /**
    @}
    @}